@@ -1,38 +1,45 @@
 #
+# ]֐ׂ͂đgݍ܂AUSI IvV EvalType őI. ȉ͊̕]֐
+# st@C̖O߂.
 # Ȃ̂miniɂƂNANOHAMINI=1̑O#A
 # Ȃ̂nanoɂƂNANOHAMINI=1̑O#tANANOHANANO=1̑O#
 # nanoperyɂƂNANOPERY=1̑O#
+# nanohannueɂƂNANOHANNUE=1̑O#
 #
 NANOHAMINI=1
 #NANOHANANO=1
 #NANOPERY=1
+#NANOHANNUE=1
 
 !IFDEF NANOHAMINI
-EVAL_TYPE=EVAL_MINI
-EVAL_OBJ=evaluate.obj
+EVAL_DEFAULT=EVAL_DEFAULT_MINI
 EXE = nanohamini.exe
 PGD = nanohamini.pgd
 PGOLOG = nanohamini_prof.txt
 !ELSEIFDEF NANOHANANO
-EVAL_TYPE=EVAL_NANO
-EVAL_OBJ=evaluate.obj
+EVAL_DEFAULT=EVAL_DEFAULT_NANO
 EXE = nanohanano.exe
 PGD = nanohanano.pgd
 PGOLOG = nanohanano_prof.txt
 !ELSEIFDEF NANOPERY
-EVAL_TYPE=EVAL_APERY
-EVAL_OBJ=evaluate_apery.obj
+EVAL_DEFAULT=EVAL_DEFAULT_APERY
 EXE = nanopery.exe
 PGD = nanopery.pgd
 PGOLOG = nanopery_prof.txt
+!ELSEIFDEF NANOHANNUE
+EVAL_DEFAULT=EVAL_DEFAULT_NNUE
+EXE = nanohannue.exe
+PGD = nanohannue.pgd
+PGOLOG = nanohannue_prof.txt
 !ELSE
 !ERROR undefined eval_type
 !ENDIF
 
-OBJS = mate1ply.obj misc.obj timeman.obj $(EVAL_OBJ) position.obj \
+OBJS = mate1ply.obj misc.obj timeman.obj evaluator.obj evaluate_nano.obj evaluate_mini.obj \
+	 evaluate_apery.obj evaluate_nnue.obj evalimage.obj position.obj \
 	 tt.obj main.obj move.obj \
 	 movegen.obj search.obj uci.obj movepick.obj thread.obj ucioption.obj \
-	 benchmark.obj book.obj \
+	 benchmark.obj evalbatch.obj book.obj \
 	 shogi.obj mate.obj problem.obj
 
 CC=cl
@@ -42,9 +49,10 @@ LD=link
 
 # Compile Options
 #
-# -DEVAL_MINI      Ȃ̂mini(2֌W(KP+PP)̕]֐)
-# -DEVAL_NANO      Ȃ̂nano(2֌W(KP̂)̕]֐)
-# -DEVAL_APERY     nanopery(Apery̕]֐)
+# -DEVAL_DEFAULT_MINI   ̕]֐Ȃ̂mini(2֌W(KP+PP)̕]֐)ɂ
+# -DEVAL_DEFAULT_NANO   ̕]֐Ȃ̂nano(2֌W(KP̂)̕]֐)ɂ
+# -DEVAL_DEFAULT_APERY  ̕]֐nanopery(Apery̕]֐)ɂ
+# -DEVAL_DEFAULT_NNUE   ̕]֐nanohannue(HalfKPNNUE]֐)ɂ
 #
 # Visual C++IvV
 #
@@ -58,7 +66,7 @@ LD=link
 # /RTCs             X^bN t[ ^C `FbN
 # /RTCu             ĂȂ[Jϐ̃`FbN
 
-FLAGS = -DNDEBUG -D$(EVAL_TYPE) -DNANOHA -DCHK_PERFORM  \
+FLAGS = -DNDEBUG -D$(EVAL_DEFAULT) -DNANOHA -DCHK_PERFORM  \
 	-DOLD_LOCKS /favor:AMD64 /EHsc /D_CRT_SECURE_NO_WARNINGS \
 	 /GL /Zc:forScope
 #CXXFLAGS=$(FLAGS) /MT /W4 /Wall /nologo /Od /GS /RTCsu
@@ -76,6 +84,13 @@ $(EXE) : $(OBJS)
 .cpp.obj :
 	$(CC) $(CXXFLAGS) /c $*.cpp
 
+# evaluate.cpp Ȃ̂nanoƂȂ̂mini̕]֐
+evaluate_nano.obj : evaluate.cpp
+	$(CC) $(CXXFLAGS) -DEVAL_NANO /c /Foevaluate_nano.obj evaluate.cpp
+
+evaluate_mini.obj : evaluate.cpp
+	$(CC) $(CXXFLAGS) -DEVAL_MINI /c /Foevaluate_mini.obj evaluate.cpp
+
 clean :
 	del /q *.obj
 	del /q *.idb
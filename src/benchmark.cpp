@@ -20,14 +20,23 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 #include "position.h"
 #include "search.h"
+#include "tt.h"
 #include "ucioption.h"
 #if defined(NANOHA)
 #include "movegen.h"
 #include "evaluate.h"
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #endif
 
 using namespace std;
@@ -219,6 +228,10 @@ namespace {
 		int result;
 		Move m;
 	};
+	struct ResultTT {
+		int policy, width, time;
+		int64_t nodes;
+	};
 	void disp_moves(MoveStack mstack[], size_t n)
 	{
 		cerr << "     ";
@@ -238,6 +251,69 @@ namespace {
 		else  {snprintf(buf, sizeof(buf), "%d ", int(nps)); }
 		return string(buf);
 	}
+
+	// n[hEFÃCxg(LbV~XAߐ)𐔂(Linux  perf_event).
+	// Ȃł -1 Ԃ
+	enum PerfEvent { PERF_CACHE_MISSES, PERF_INSTRUCTIONS };
+
+	class PerfCounter {
+	public:
+		explicit PerfCounter(PerfEvent e) : fd(-1) {
+#if defined(__linux__)
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = (e == PERF_CACHE_MISSES) ? PERF_COUNT_HW_CACHE_MISSES : PERF_COUNT_HW_INSTRUCTIONS;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+			(void)e;
+#endif
+		}
+		~PerfCounter() {
+#if defined(__linux__)
+			if (fd >= 0) close(fd);
+#endif
+		}
+		void start() {
+#if defined(__linux__)
+			if (fd < 0) return;
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+		}
+		int64_t stop() {
+#if defined(__linux__)
+			uint64_t count;
+			if (fd < 0) return -1;
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &count, sizeof(count)) == sizeof(count)) return int64_t(count);
+#endif
+			return -1;
+		}
+	private:
+		int fd;
+	};
+
+	// ]1̌̕v
+	struct EvalStageResult {
+		const char* name;
+		int calls;
+		int time;					// ms
+		int64_t misses, instructions;	// ȂƂ -1
+	};
+
+	// per_call() 1񂠂̐𕶎ɂ. ȂƂ n/a(csv ͋)
+	string per_call(const int64_t n, const int calls, const bool csv)
+	{
+		if (n < 0) return csv ? "" : "n/a";
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%.2f", double(n) / calls);
+		return string(buf);
+	}
 }
 
 // 1l or 3l
@@ -470,6 +546,11 @@ void bench_eval(int argc, char* argv[]) {
 	// ftHglݒ
 	string fenFile = argc > 2 ? argv[2] : "default";
 	bool bDisplay = argc > 3 ? (string(argv[3]) == "yes" ? true : false) : false;
+	bool csv      = argc > 4 ? (string(argv[4]) == "csv") : false;
+	string evalName = argc > 5 ? argv[5] : "";
+
+	if (!evalName.empty())
+		select_evaluator(evalName);
 
 	cerr << "Benchmark type: evaluate." << endl;
 
@@ -512,7 +593,8 @@ void bench_eval(int argc, char* argv[]) {
 	int j;
 	volatile Value v = VALUE_ZERO;
 	Value m = VALUE_ZERO;
-	for (size_t i = 0; i < sfenList.size(); i++)
+	// ǖʂƂ̌v͋ǖʂ̐ɔႵĎԂ̂ŁAcsv ̂Ƃ͏Ȃ
+	for (size_t i = 0; i < sfenList.size() && !csv; i++)
 	{
 		Position pos(sfenList[i], 0);
 #if defined(_DEBUG)
@@ -530,9 +612,201 @@ void bench_eval(int argc, char* argv[]) {
 		cerr << "  evaluate():m=" << pos.get_material() << ", v= " << int(v) << ", margin=" << int(m) << ", time= " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << " evaluate/s" << endl;
 	}
 
+	// ̌v͓ǖʂ̌JԂȂ̂ŁA2ڂ͕]l̃LbVƍ̘aōς.
+	// ł͋ǖʂɐ؂ւȂ疈ꂩ]A]e[u
+	// LbV~X̉񐔂𑪂(ʂ̂Ȃǖʂ͏). ]S(full)̂قA]
+	// (EvalStage)Ƃɂ.  HAND, LIST, SUMS ̏ɁAO̕
+	// ʂ̃Xg(EvalScratch)gđ
+	const size_t MaxFullEvalPositions = 10000;
+	static const char* const StageNames[EVAL_STAGE_NB] = { "hand", "list", "sums", "material" };
+	vector<Position*> posList;
+	vector<EvalScratch> scratch;
+	vector<EvalStageResult> results;
+	for (size_t i = 0; i < sfenList.size() && posList.size() < MaxFullEvalPositions; i++)
+	{
+		Position* pos = new Position(sfenList[i], 0);
+		if (pos->king_square(BLACK) && pos->king_square(WHITE))
+			posList.push_back(pos);
+		else
+			delete pos;
+	}
+	scratch.resize(posList.size());
+	for (size_t i = 0; i < posList.size(); i++)
+	{
+		posList[i]->eval_stage(EVAL_STAGE_HAND, scratch[i]);
+		posList[i]->eval_stage(EVAL_STAGE_LIST, scratch[i]);
+	}
+	for (int s = -1; s < EVAL_STAGE_NB && !posList.empty(); s++)
+	{
+		PerfCounter missCounter(PERF_CACHE_MISSES), instCounter(PERF_INSTRUCTIONS);
+		volatile int sink = 0;
+		int rap_time = get_system_time();
+		missCounter.start();
+		instCounter.start();
+		if (s < 0) {
+			for (j = 0; j < loops; j++) {
+				Position& pos = *posList[j % posList.size()];
+				pos.reset_evaluation();
+				sink = pos.evaluate(pos.side_to_move());
+			}
+		} else {
+			for (j = 0; j < loops; j++) {
+				const size_t k = j % posList.size();
+				sink = posList[k]->eval_stage(EvalStage(s), scratch[k]);
+			}
+		}
+		const EvalStageResult r = { s < 0 ? "full" : StageNames[s], loops,
+		                            get_system_time() - rap_time, missCounter.stop(), instCounter.stop() };
+		(void)sink;
+		results.push_back(r);
+	}
+
+	if (!posList.empty())
+	{
+		cerr << "\nFull evaluation of " << posList.size() << " positions, "
+		     << eval_type_name(Position::evaluator()) << ":" << endl;
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const EvalStageResult& r = results[i];
+			char buf[128];
+			snprintf(buf, sizeof(buf), "  %-9s %8.1f ns/call", r.name, r.time * 1e6 / r.calls);
+			cerr << buf << ", cache misses= " << per_call(r.misses, r.calls, false)
+			     << "/call, instructions= " << per_call(r.instructions, r.calls, false) << "/call" << endl;
+		}
+	}
+
+	// CI ȂǂŔׂ悤Acsv Wo͂ɏo
+	if (csv)
+	{
+		cout << "evaluator,stage,positions,calls,ns_per_call,cache_misses_per_call,instructions_per_call" << endl;
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const EvalStageResult& r = results[i];
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.2f", r.time * 1e6 / r.calls);
+			cout << eval_type_name(Position::evaluator()) << ',' << r.name << ',' << posList.size() << ','
+			     << r.calls << ',' << buf << ',' << per_call(r.misses, r.calls, true) << ','
+			     << per_call(r.instructions, r.calls, true) << endl;
+		}
+	}
+
+	for (size_t i = 0; i < posList.size(); i++)
+		delete posList[i];
+
 	time = get_system_time() - time;
 
 	cerr << "\n==============================="
 		 << "\nTotal time (ms) : " << time << endl;
 }
+
+// u\̒u̔r.
+/// bench_tt() compares the replacement policies of the transposition table.
+/// The positions are searched to a fixed depth with each policy and each
+/// bucket width, starting from an empty table each time. The parameters are
+/// the table size, the number of threads, the depth, the positions file and
+/// a comma separated list of bucket widths (default 4).
+
+void bench_tt(int argc, char* argv[]) {
+
+	static const char* PolicyNames[REPLACE_POLICY_NB] = { "default", "two-tier", "age-depth" };
+
+	vector<string> sfenList;
+	vector<int> widthList;
+	vector<ResultTT> results;
+	SearchLimits limits;
+
+	string ttSize  = argc > 2 ? argv[2] : "128";
+	string threads = argc > 3 ? argv[3] : "1";
+	string valStr  = argc > 4 ? argv[4] : "12";
+	string fenFile = argc > 5 ? argv[5] : "default";
+	string widths  = argc > 6 ? argv[6] : "4";
+
+	Options["Hash"].set_value(ttSize);
+	Options["Threads"].set_value(threads);
+	Options["OwnBook"].set_value("false");
+	limits.maxDepth = atoi(valStr.c_str());
+
+	if (fenFile != "default")
+	{
+		string fen;
+		ifstream f(fenFile.c_str());
+
+		if (!f.is_open())
+		{
+			cerr << "Unable to open file " << fenFile << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		while (getline(f, fen)) {
+			if (!fen.empty()) {
+				if (fen.compare(0, 5, "sfen ") == 0) {
+					fen.erase(0, 5);
+				}
+				sfenList.push_back(fen);
+			}
+		}
+
+		f.close();
+	}
+	else {
+		for (int i = 0; !Defaults[i].empty(); i++) {
+			sfenList.push_back(Defaults[i]);
+		}
+	}
+
+	std::istringstream ws(widths);
+	string w;
+	while (getline(ws, w, ','))
+		if (atoi(w.c_str()) > 0)
+			widthList.push_back(atoi(w.c_str()));
+
+	for (size_t k = 0; k < widthList.size(); k++)
+	{
+		std::ostringstream width;
+		width << widthList[k];
+		Options["TTBucketSize"].set_value(width.str());
+
+		for (int p = 0; p < REPLACE_POLICY_NB; p++)
+		{
+			std::ostringstream policy;
+			policy << p;
+			Options["TTReplacePolicy"].set_value(policy.str());
+			Options["Clear Hash"].set_value("true");
+
+			ResultTT r;
+			r.policy = p;
+			r.width = widthList[k];
+			r.nodes = 0;
+			r.time = get_system_time();
+
+			for (size_t i = 0; i < sfenList.size(); i++)
+			{
+				Move moves[] = { MOVE_NONE };
+				Position pos(sfenList[i], 0);
+
+				cerr << "\nPolicy " << PolicyNames[p] << " bucket " << widthList[k]
+				     << " position: " << i + 1 << '/' << sfenList.size() << endl;
+
+				if (!think(pos, limits, moves))
+					break;
+
+				r.nodes += pos.nodes_searched() + pos.tnodes_searched();
+			}
+
+			r.time = get_system_time() - r.time;
+			results.push_back(r);
+		}
+	}
+
+	cerr << "\n==============================="
+	     << "\nPolicy     Bucket  Time(ms)       Nodes" << endl;
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		char buf[128];
+		snprintf(buf, sizeof(buf), "%-10s %6d %9d %11lld", PolicyNames[results[i].policy],
+		         results[i].width, results[i].time, (long long)results[i].nodes);
+		cerr << buf << endl;
+	}
+}
 #endif
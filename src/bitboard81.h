@@ -0,0 +1,118 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(BITBOARD81_H_INCLUDED)
+#define BITBOARD81_H_INCLUDED
+
+#include "types.h"
+
+
+/// Bitboard81 is a set of squares of the shogi board, kept by Position next
+/// to the mailbox ban[]. A square 0xXY of the mailbox, file X and rank Y, is
+/// the bit (X-1)*9 + (Y-1): the files 1 to 7 are in p[0], the files 8 and 9
+/// in the low 18 bits of p[1]. A file is then 9 consecutive bits, and the
+/// squares come out of pop_lsb() in the order of the loops over files and
+/// ranks of the move generators.
+
+struct Bitboard81 {
+
+	uint64_t p[2];
+
+	Bitboard81() {}
+	Bitboard81(uint64_t p0, uint64_t p1) { p[0] = p0; p[1] = p1; }
+
+	bool any() const { return (p[0] | p[1]) != 0; }
+	bool is_set(int i) const { return i < 63 ? (p[0] >> i) & 1 : (p[1] >> (i - 63)) & 1; }
+	void toggle(int i) { if (i < 63) p[0] ^= uint64_t(1) << i; else p[1] ^= uint64_t(1) << (i - 63); }
+
+	Bitboard81 operator&(const Bitboard81& b) const { return Bitboard81(p[0] & b.p[0], p[1] & b.p[1]); }
+	Bitboard81 operator|(const Bitboard81& b) const { return Bitboard81(p[0] | b.p[0], p[1] | b.p[1]); }
+	Bitboard81& operator|=(const Bitboard81& b) { p[0] |= b.p[0]; p[1] |= b.p[1]; return *this; }
+	Bitboard81& operator^=(const Bitboard81& b) { p[0] ^= b.p[0]; p[1] ^= b.p[1]; return *this; }
+
+	// The squares of the board not in the set
+	Bitboard81 operator~() const { return Bitboard81(~p[0] & AllP0, ~p[1] & AllP1); }
+
+	// Removes the lowest square of a non empty set and returns its index
+	int pop_lsb() {
+		if (p[0]) {
+			const int i = lsb(p[0]);
+			p[0] &= p[0] - 1;
+			return i;
+		}
+		const int i = lsb(p[1]) + 63;
+		p[1] &= p[1] - 1;
+		return i;
+	}
+
+	static const uint64_t AllP0 = (uint64_t(1) << 63) - 1;
+	static const uint64_t AllP1 = (uint64_t(1) << 18) - 1;
+
+	static int lsb(uint64_t b) {
+#if defined(_MSC_VER) && defined(_WIN64)
+		unsigned long i;
+		_BitScanForward64(&i, b);
+		return int(i);
+#elif defined(__GNUC__)
+		return __builtin_ctzll(b);
+#else
+		int i = 0;
+		while (!(b & 1)) { b >>= 1; i++; }
+		return i;
+#endif
+	}
+};
+
+/// bb81_index() and bb81_square() convert a square of the mailbox to its bit
+/// in a Bitboard81 and back.
+
+inline int bb81_index(int z) {
+	return ((z >> 4) - 1) * 9 + (z & 0x0F) - 1;
+}
+
+inline int bb81_square(int i) {
+	return (i / 9 + 1) * 0x10 + i % 9 + 1;
+}
+
+/// file_bb81() is the file 'f' (0 to 8, for the files 1 to 9) of the board.
+
+inline Bitboard81 file_bb81(int f) {
+	return f < 7 ? Bitboard81(uint64_t(0x1FF) << (9 * f), 0)
+	             : Bitboard81(0, uint64_t(0x1FF) << (9 * (f - 7)));
+}
+
+/// files_bb81() is the files of the 9-bit 'mask', bit f for the file f+1.
+/// The multiplications move the bit f of each word to the bit 9f and then
+/// spread it over the 9 bits of the file.
+
+inline Bitboard81 files_bb81(int mask) {
+	const uint64_t m0 = uint64_t(mask & 0x7F), m1 = uint64_t(mask >> 7);
+	return Bitboard81(((m0 * 0x01010101010101ULL) & 0x0040201008040201ULL) * 0x1FF,
+	                  ((m1 * 0x101) & 0x201) * 0x1FF);
+}
+
+/// rank_bb81() is the ranks 'lo' to 'hi' (1 to 9) of all the files.
+
+inline Bitboard81 rank_bb81(int lo, int hi) {
+	const uint64_t r = (uint64_t(1) << hi) - (uint64_t(1) << (lo - 1));
+	return Bitboard81(r * 0x0040201008040201ULL, r * 0x201);
+}
+
+#endif // !defined(BITBOARD81_H_INCLUDED)
@@ -0,0 +1,343 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) || defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "lock.h"
+#include "misc.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "ucioption.h"
+
+using namespace std;
+
+namespace {
+
+	// Positions are read, evaluated and written in batches of this many lines.
+	// While the workers evaluate a batch, the calling thread writes the scores
+	// of the previous batch and reads the next one.
+	const size_t BatchSize = 64 * 1024;
+
+	const int MaxWorkers = 256;
+
+	struct Batch {
+		vector<string> sfens;
+		vector<int64_t> lineNumbers;
+		vector<int32_t> scores;
+		vector<string> text;		// CSV output, one string per worker
+		size_t count;
+		bool pending;				// evaluated, not written yet
+	};
+
+	struct Worker {
+		int id;
+		Batch* batch;
+		size_t begin, end;
+		bool qsearch, csv;
+		int invalid;
+#if defined(_MSC_VER) || defined(_WIN32)
+		HANDLE handle;
+#else
+		pthread_t handle;
+#endif
+		bool started;
+	};
+
+	// append_int() formats 'v' at the end of 's', much faster than a stream
+	void append_int(string& s, int64_t v) {
+
+		char buf[24];
+		char* p = buf + sizeof(buf);
+		uint64_t u = v < 0 ? uint64_t(-v) : uint64_t(v);
+
+		do *--p = char('0' + u % 10); while (u /= 10);
+		if (v < 0)
+			*--p = '-';
+
+		s.append(p, buf + sizeof(buf) - p);
+	}
+
+	// evaluate_range() evaluates the positions of a worker. A position without
+	// both kings can't be evaluated, its score is VALUE_NONE.
+	void evaluate_range(Worker* w) {
+
+		Batch& b = *w->batch;
+
+		for (size_t i = w->begin; i < w->end; i++)
+		{
+			Position pos(b.sfens[i], 0);
+			int32_t v;
+
+			if (!pos.king_square(BLACK) || !pos.king_square(WHITE))
+			{
+				v = VALUE_NONE;
+				w->invalid++;
+			}
+			else if (w->qsearch)
+				v = qsearch_value(pos);
+			else
+				v = pos.evaluate(pos.side_to_move());
+
+			b.scores[i] = v;
+		}
+
+		if (!w->csv)
+			return;
+
+		string& s = b.text[w->id];
+		s.clear();
+		for (size_t i = w->begin; i < w->end; i++)
+		{
+			append_int(s, b.lineNumbers[i]);
+			s += ',';
+			append_int(s, b.scores[i]);
+			s += '\n';
+		}
+	}
+
+#if defined(_MSC_VER) || defined(_WIN32)
+
+	DWORD WINAPI batch_routine(LPVOID worker)
+	{
+
+		evaluate_range((Worker *)worker);
+		return 0;
+	}
+
+#else
+
+	void *batch_routine(void *worker)
+	{
+
+		evaluate_range((Worker *)worker);
+		return NULL;
+	}
+
+#endif
+
+	// read_batch() reads the next BatchSize positions of the file
+	void read_batch(ifstream& f, Batch& b, int64_t& lineNumber) {
+
+		b.count = 0;
+		while (b.count < BatchSize && getline(f, b.sfens[b.count]))
+		{
+			string& sfen = b.sfens[b.count];
+			lineNumber++;
+
+			if (sfen.empty())
+				continue;
+
+			if (sfen.compare(0, 5, "sfen ") == 0)
+				sfen.erase(0, 5);
+
+			b.lineNumbers[b.count++] = lineNumber;
+		}
+	}
+
+	void write_batch(FILE* fp, Batch& b, bool csv, int workers) {
+
+		if (csv)
+			for (int i = 0; i < workers; i++)
+				fwrite(b.text[i].data(), 1, b.text[i].size(), fp);
+		else if (b.count)
+			fwrite(&b.scores[0], sizeof(int32_t), b.count, fp);
+
+		b.pending = false;
+	}
+
+	// start_workers() splits the batch in contiguous ranges, one per worker,
+	// and launches a helper thread for each range. The calling thread is left
+	// free to write and read the files meanwhile.
+	void start_workers(Worker workers[], int cnt, Batch& b) {
+
+		const size_t chunk = (b.count + cnt - 1) / cnt;
+
+		for (int i = 0; i < cnt; i++)
+		{
+			workers[i].batch = &b;
+			workers[i].begin = Min(chunk * i, b.count);
+			workers[i].end = Min(chunk * (i + 1), b.count);
+			workers[i].started = false;
+		}
+
+		// qsearch() recurses deeply, the helpers get the stack of a search thread
+		for (int i = 0; i < cnt; i++)
+		{
+#if defined(_MSC_VER) || defined(_WIN32)
+			workers[i].handle = CreateThread(NULL, 1024 * 1024 * 32, batch_routine, (LPVOID)&workers[i], 0, NULL);
+			workers[i].started = (workers[i].handle != NULL);
+#else
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setstacksize(&attr, 1024 * 1024 * 32);
+			workers[i].started = (pthread_create(&workers[i].handle, &attr, batch_routine, (void *)&workers[i]) == 0);
+			pthread_attr_destroy(&attr);
+#endif
+		}
+	}
+
+	void join_workers(Worker workers[], int cnt) {
+
+		// The calling thread evaluates the ranges of the helpers that could not
+		// be launched.
+		for (int i = 0; i < cnt; i++)
+			if (!workers[i].started)
+				evaluate_range(&workers[i]);
+
+		for (int i = 0; i < cnt; i++)
+			if (workers[i].started) {
+#if defined(_MSC_VER) || defined(_WIN32)
+				WaitForSingleObject(workers[i].handle, INFINITE);
+				CloseHandle(workers[i].handle);
+#else
+				pthread_join(workers[i].handle, NULL);
+#endif
+			}
+	}
+
+} // namespace
+
+
+/// evalbatch() evaluates every position of a SFEN file, one position per line,
+/// and writes the scores in the order of the file. The scores are from the
+/// point of view of the side to move, VALUE_NONE for a position without both
+/// kings. The parameters are the positions file, the number of threads
+/// (default: the number of cores), "eval" for the static evaluation or
+/// "qsearch" for the value of a quiescence search (default eval), the output
+/// file ("-" is stdout, the default) and its format: "csv" writes a line
+/// "<line number>,<score>" per position, "bin" a 32 bit integer per position
+/// in the byte order of the host.
+
+void evalbatch(int argc, char* argv[]) {
+
+	string sfenFile = argc > 2 ? argv[2] : "";
+	int threads     = argc > 3 ? atoi(argv[3]) : cpu_count();
+	string mode     = argc > 4 ? argv[4] : "eval";
+	string outFile  = argc > 5 ? argv[5] : "-";
+	string format   = argc > 6 ? argv[6] : "csv";
+
+	if (threads < 1 || threads > MaxWorkers || (mode != "eval" && mode != "qsearch")
+	    || (format != "csv" && format != "bin"))
+	{
+		cerr << "Usage: nanohamini evalbatch <sfen file> [threads] [eval | qsearch] "
+		        "[output file = -] [csv | bin]" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	ifstream f(sfenFile.c_str());
+	if (!f.is_open())
+	{
+		cerr << "Unable to open file " << sfenFile << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* fp = stdout;
+	if (outFile != "-" && (fp = fopen(outFile.c_str(), "wb")) == NULL)
+	{
+		cerr << "Unable to open file " << outFile << endl;
+		exit(EXIT_FAILURE);
+	}
+#if defined(_MSC_VER) || defined(_WIN32)
+	if (fp == stdout)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	// The workers share the positions of thread 0, whose evaluation cache
+	// isn't thread safe. It is of no use here anyway, the positions differ.
+	Options["EvalCache"].set_value("0");
+	Threads.read_uci_options();
+
+	const bool csv = (format == "csv");
+	Batch batches[2];
+	vector<Worker> workers(threads);
+
+	for (int i = 0; i < 2; i++)
+	{
+		batches[i].sfens.resize(BatchSize);
+		batches[i].lineNumbers.resize(BatchSize);
+		batches[i].scores.resize(BatchSize);
+		batches[i].text.resize(threads);
+		batches[i].pending = false;
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		workers[i].id = i;
+		workers[i].qsearch = (mode == "qsearch");
+		workers[i].csv = csv;
+		workers[i].invalid = 0;
+	}
+
+	if (csv)
+		fputs("line,score\n", fp);
+
+	int64_t lineNumber = 0, total = 0;
+	int time = get_system_time();
+	int k = 0;
+
+	// batches[k] is read and waits for the workers, batches[k ^ 1] holds the
+	// scores of the previous batch until they are written.
+	read_batch(f, batches[k], lineNumber);
+
+	while (batches[k].count)
+	{
+		start_workers(&workers[0], threads, batches[k]);
+
+		if (batches[k ^ 1].pending)
+			write_batch(fp, batches[k ^ 1], csv, threads);
+
+		read_batch(f, batches[k ^ 1], lineNumber);
+
+		join_workers(&workers[0], threads);
+		batches[k].pending = true;
+		total += batches[k].count;
+		k ^= 1;
+	}
+
+	if (batches[k ^ 1].pending)
+		write_batch(fp, batches[k ^ 1], csv, threads);
+
+	time = get_system_time() - time;
+
+	int invalid = 0;
+	for (int i = 0; i < threads; i++)
+		invalid += workers[i].invalid;
+
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+
+	cerr << "\n==============================="
+	     << "\nPositions       : " << total
+	     << "\nInvalid         : " << invalid
+	     << "\nTotal time (ms) : " << time
+	     << "\nPositions/second: " << (int64_t)(total / ((time ? time : 1) / 1000.0)) << endl;
+}
@@ -0,0 +1,262 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(EVALFEATURE_H_INCLUDED)
+#define EVALFEATURE_H_INCLUDED
+
+#include "position.h"
+
+
+/// The features of the Apery and NNUE evaluation functions, the "BonaPiece"
+/// of Bonanza: a piece other than a king on a square, or the i-th piece of a
+/// kind in a hand. list0 holds the features seen from the black side, list1
+/// the same pieces seen from the white side with the board turned around.
+/// The numbering is the one of Apery, which the HalfKP networks of YaneuraOu
+/// use as well.
+
+namespace EvalFeature {
+
+	enum { nhand = 7, nfile = 9, nrank = 9, nsquare = 81 };
+
+	// Offsets of the features. f_xxx are the pieces of the side the list
+	// belongs to, e_xxx the pieces of the other side. Like in Bonanza a hand
+	// of 0 pieces has an index, which is never used.
+	enum {
+		f_hand_pawn   = 0,
+		e_hand_pawn   = f_hand_pawn   + 19,
+		f_hand_lance  = e_hand_pawn   + 19,
+		e_hand_lance  = f_hand_lance  +  5,
+		f_hand_knight = e_hand_lance  +  5,
+		e_hand_knight = f_hand_knight +  5,
+		f_hand_silver = e_hand_knight +  5,
+		e_hand_silver = f_hand_silver +  5,
+		f_hand_gold   = e_hand_silver +  5,
+		e_hand_gold   = f_hand_gold   +  5,
+		f_hand_bishop = e_hand_gold   +  5,
+		e_hand_bishop = f_hand_bishop +  3,
+		f_hand_rook   = e_hand_bishop +  3,
+		e_hand_rook   = f_hand_rook   +  3,
+		fe_hand_end   = e_hand_rook   +  3,
+
+		f_pawn        = fe_hand_end,
+		e_pawn        = f_pawn        + 81,
+		f_lance       = e_pawn        + 81,
+		e_lance       = f_lance       + 81,
+		f_knight      = e_lance       + 81,
+		e_knight      = f_knight      + 81,
+		f_silver      = e_knight      + 81,
+		e_silver      = f_silver      + 81,
+		f_gold        = e_silver      + 81,
+		e_gold        = f_gold        + 81,
+		f_bishop      = e_gold        + 81,
+		e_bishop      = f_bishop      + 81,
+		f_horse       = e_bishop      + 81,
+		e_horse       = f_horse       + 81,
+		f_rook        = e_horse       + 81,
+		e_rook        = f_rook        + 81,
+		f_dragon      = e_rook        + 81,
+		e_dragon      = f_dragon      + 81,
+		fe_end        = e_dragon      + 81
+	};
+
+	// The squares are numbered file by file (1a = 0, 1b = 1, ...), unlike
+	// NanohaTbl::z2sq which numbers them rank by rank.
+	const short z2sq[] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1,  0,  1,  2,  3,  4,  5,  6,  7,  8, -1, -1, -1, -1, -1, -1,
+		-1,  9, 10, 11, 12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1,
+		-1, 18, 19, 20, 21, 22, 23, 24, 25, 26, -1, -1, -1, -1, -1, -1,
+		-1, 27, 28, 29, 30, 31, 32, 33, 34, 35, -1, -1, -1, -1, -1, -1,
+		-1, 36, 37, 38, 39, 40, 41, 42, 43, 44, -1, -1, -1, -1, -1, -1,
+		-1, 45, 46, 47, 48, 49, 50, 51, 52, 53, -1, -1, -1, -1, -1, -1,
+		-1, 54, 55, 56, 57, 58, 59, 60, 61, 62, -1, -1, -1, -1, -1, -1,
+		-1, 63, 64, 65, 66, 67, 68, 69, 70, 71, -1, -1, -1, -1, -1, -1,
+		-1, 72, 73, 74, 75, 76, 77, 78, 79, 80, -1, -1, -1, -1, -1, -1,
+	};
+
+	// Piece on the board -> feature of the piece on square 0
+	const struct {
+		int f_pt, e_pt;
+	} base_tbl[] = {
+		{-1      , -1      },	//  0:---
+		{f_pawn  , e_pawn  },	//  1:SFU
+		{f_lance , e_lance },	//  2:SKY
+		{f_knight, e_knight},	//  3:SKE
+		{f_silver, e_silver},	//  4:SGI
+		{f_gold  , e_gold  },	//  5:SKI
+		{f_bishop, e_bishop},	//  6:SKA
+		{f_rook  , e_rook  },	//  7:SHI
+		{-1      , -1      },	//  8:SOU
+		{f_gold  , e_gold  },	//  9:STO
+		{f_gold  , e_gold  },	// 10:SNY
+		{f_gold  , e_gold  },	// 11:SNK
+		{f_gold  , e_gold  },	// 12:SNG
+		{-1      , -1      },	// 13:--
+		{f_horse , e_horse },	// 14:SUM
+		{f_dragon, e_dragon},	// 15:SRY
+		{-1      , -1      },	// 16:---
+		{e_pawn  , f_pawn  },	// 17:GFU
+		{e_lance , f_lance },	// 18:GKY
+		{e_knight, f_knight},	// 19:GKE
+		{e_silver, f_silver},	// 20:GGI
+		{e_gold  , f_gold  },	// 21:GKI
+		{e_bishop, f_bishop},	// 22:GKA
+		{e_rook  , f_rook  },	// 23:GHI
+		{-1      , -1      },	// 24:GOU
+		{e_gold  , f_gold  },	// 25:GTO
+		{e_gold  , f_gold  },	// 26:GNY
+		{e_gold  , f_gold  },	// 27:GNK
+		{e_gold  , f_gold  },	// 28:GNG
+		{-1      , -1      },	// 29:---
+		{e_horse , f_horse },	// 30:GUM
+		{e_dragon, f_dragon}	// 31:GRY
+	};
+
+	// Kind of piece in hand -> feature of 0 pieces of the kind (add the count)
+	const struct {
+		int f_pt, e_pt;
+	} hand_tbl[8] = {
+		{-1           , -1           },
+		{f_hand_pawn  , e_hand_pawn  },
+		{f_hand_lance , e_hand_lance },
+		{f_hand_knight, e_hand_knight},
+		{f_hand_silver, e_hand_silver},
+		{f_hand_gold  , e_hand_gold  },
+		{f_hand_bishop, e_hand_bishop},
+		{f_hand_rook  , e_hand_rook  },
+	};
+	const uint32_t hand_mask[8] = {
+		0, HAND_FU_MASK, HAND_KY_MASK, HAND_KE_MASK, HAND_GI_MASK, HAND_KI_MASK, HAND_KA_MASK, HAND_HI_MASK,
+	};
+	const int hand_shift[8] = {
+		0, HAND_FU_SHIFT, HAND_KY_SHIFT, HAND_KE_SHIFT, HAND_GI_SHIFT, HAND_KI_SHIFT, HAND_KA_SHIFT, HAND_HI_SHIFT,
+	};
+
+	inline int inv(const int sq) { return nsquare - 1 - sq; }
+
+	inline void board_feature(const int piece, const int sq, int& k0, int& k1)
+	{
+		k0 = base_tbl[piece].f_pt + sq;
+		k1 = base_tbl[piece].e_pt + inv(sq);
+	}
+
+	inline void hand_feature(const Color c, const int pt, const int i, int& k0, int& k1)
+	{
+		k0 = (c == BLACK ? hand_tbl[pt].f_pt : hand_tbl[pt].e_pt) + i;
+		k1 = (c == BLACK ? hand_tbl[pt].e_pt : hand_tbl[pt].f_pt) + i;
+	}
+
+	// make_list_hand() appends the features of the pieces in hand to the lists
+	// and returns their number. The board is done by Position::make_list_apery().
+	inline int make_list_hand(const uint32_t handB, const uint32_t handW, int list0[], int list1[])
+	{
+		int nlist = 0;
+		for (int pt = 1; pt < 8; pt++) {
+			for (int i = (handB & hand_mask[pt]) >> hand_shift[pt]; i >= 1; --i) {
+				hand_feature(BLACK, pt, i, list0[nlist], list1[nlist]);
+				++nlist;
+			}
+			for (int i = (handW & hand_mask[pt]) >> hand_shift[pt]; i >= 1; --i) {
+				hand_feature(WHITE, pt, i, list0[nlist], list1[nlist]);
+				++nlist;
+			}
+		}
+		return nlist;
+	}
+
+	// Above this many changed features a full computation is faster than an
+	// incremental one.
+	const int MaxDiffFeatures = 8;
+
+	// FeatureDiff is the set of features changed by a sequence of moves. A
+	// feature that is added and then removed (or the other way around)
+	// cancels out.
+	struct FeatureDiff {
+		int rem0[MaxDiffFeatures], rem1[MaxDiffFeatures];	// removed features
+		int add0[MaxDiffFeatures], add1[MaxDiffFeatures];	// added features
+		int nrem, nadd;
+
+		static bool cancel(int f0[], int f1[], int& n, const int k0) {
+			for (int i = 0; i < n; i++) {
+				if (f0[i] == k0) {
+					--n;
+					f0[i] = f0[n];
+					f1[i] = f1[n];
+					return true;
+				}
+			}
+			return false;
+		}
+		void remove(const int k0, const int k1) {
+			if (!cancel(add0, add1, nadd, k0)) { rem0[nrem] = k0; rem1[nrem] = k1; nrem++; }
+		}
+		void add(const int k0, const int k1) {
+			if (!cancel(rem0, rem1, nrem, k0)) { add0[nadd] = k0; add1[nadd] = k1; nadd++; }
+		}
+		bool is_added(const int k0) const {
+			for (int i = 0; i < nadd; i++) if (add0[i] == k0) return true;
+			return false;
+		}
+
+		// add_move() adds the features changed by the move that led to 's',
+		// seen backwards from 's': 'h' holds the hands of 's' on entry and of
+		// the position before it on exit. A king is not a feature, for a king
+		// move only a capture changes the features.
+		void add_move(const StateInfo* s, uint32_t h[2]) {
+			const Move m = s->lastMove;
+			const int from = move_from(m);
+			const int sqTo = z2sq[move_to(m)];
+			const Piece before = move_piece(m);		// piece moved or dropped
+			const Piece after = is_promotion(m) ? Piece(before | PROMOTED) : before;
+			const Piece capture = s->captured;
+			const Color us = color_of(before);
+			const bool isKing = (before == SOU || before == GOU);
+			int k0, k1;
+
+			if (!isKing) {
+				board_feature(after, sqTo, k0, k1);
+				add(k0, k1);
+			}
+			if (from == 0) {
+				// Drop: the last piece of the kind in hand goes away
+				const int pt = before & ~GOTE;
+				h[us] += Hand::tbl[pt];
+				hand_feature(us, pt, (h[us] & hand_mask[pt]) >> hand_shift[pt], k0, k1);
+				remove(k0, k1);
+				return;
+			}
+			if (!isKing) {
+				board_feature(before, z2sq[from], k0, k1);
+				remove(k0, k1);
+			}
+			if (capture) {
+				// Capture: the captured piece leaves the board, one more piece in hand
+				const int pt = capture & ~(GOTE | PROMOTED);
+				board_feature(capture, sqTo, k0, k1);
+				remove(k0, k1);
+				hand_feature(us, pt, (h[us] & hand_mask[pt]) >> hand_shift[pt], k0, k1);
+				add(k0, k1);
+				h[us] -= Hand::tbl[pt];
+			}
+		}
+	};
+}
+
+#endif // !defined(EVALFEATURE_H_INCLUDED)
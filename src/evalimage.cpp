@@ -0,0 +1,250 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+
+#if defined(_MSC_VER) || defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "evalimage.h"
+
+namespace {
+
+	const char ImageMagic[8] = { 'N', 'A', 'N', 'O', 'E', 'V', 'A', 'L' };
+	const uint32_t ImageVersion = 1;
+	const size_t HeaderBytes = 64;
+
+	// checksum() is a Fletcher like sum over 64 bit words. It is cheap enough
+	// to check a few hundred MB at every start, and unlike a plain sum it
+	// notices swapped blocks. The payload size is a multiple of 8 bytes.
+	uint64_t checksum(const void* data, size_t bytes) {
+
+		const uint64_t* p = static_cast<const uint64_t*>(data);
+		uint64_t a = 0, b = 0;
+
+		for (size_t i = 0; i < bytes / 8; i++)
+		{
+			a += p[i];
+			b += a;
+		}
+		return a ^ (b << 1 | b >> 63);
+	}
+
+	void fill_header(EvalImage::ImageHeader& h, const char* tag, uint64_t stamp, const void* data, size_t bytes) {
+
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, ImageMagic, sizeof(h.magic));
+		h.version = ImageVersion;
+		h.headerBytes = uint32_t(HeaderBytes);
+		strncpy(h.tag, tag, sizeof(h.tag) - 1);
+		h.sourceStamp = stamp;
+		h.payloadBytes = bytes;
+		h.checksum = checksum(data, bytes);
+	}
+
+	bool valid_header(const EvalImage::ImageHeader& h, const char* tag, uint64_t stamp, size_t bytes) {
+
+		return   !memcmp(h.magic, ImageMagic, sizeof(h.magic))
+			&& h.version == ImageVersion
+			&& h.headerBytes == HeaderBytes
+			&& !strncmp(h.tag, tag, sizeof(h.tag))
+			&& (stamp == 0 || h.sourceStamp == stamp)
+			&& h.payloadBytes == bytes;
+	}
+
+	// map_file() maps the whole file read-only, NULL on error
+	const char* map_file(const std::string& fname, size_t& fileBytes) {
+
+#if defined(_MSC_VER) || defined(_WIN32)
+		HANDLE fd = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fd == INVALID_HANDLE_VALUE)
+			return NULL;
+
+		LARGE_INTEGER size;
+		HANDLE mh = NULL;
+		const char* p = NULL;
+
+		if (GetFileSizeEx(fd, &size) && size.QuadPart >= LONGLONG(HeaderBytes))
+			mh = CreateFileMapping(fd, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mh)
+		{
+			p = static_cast<const char*>(MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mh);
+		}
+		CloseHandle(fd);
+
+		fileBytes = p ? size_t(size.QuadPart) : 0;
+		return p;
+#else
+		int fd = open(fname.c_str(), O_RDONLY);
+		if (fd < 0)
+			return NULL;
+
+		struct stat st;
+		void* p = MAP_FAILED;
+
+		if (fstat(fd, &st) == 0 && st.st_size >= off_t(HeaderBytes))
+			p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (p == MAP_FAILED)
+			return NULL;
+
+		fileBytes = size_t(st.st_size);
+		return static_cast<const char*>(p);
+#endif
+	}
+
+	void unmap_file(const char* p, size_t fileBytes) {
+
+#if defined(_MSC_VER) || defined(_WIN32)
+		(void)fileBytes;
+		UnmapViewOfFile(p);
+#else
+		munmap(const_cast<char*>(p), fileBytes);
+#endif
+	}
+
+} // namespace
+
+
+uint64_t EvalImage::source_stamp(const char* const fnames[], int count) {
+
+	uint64_t stamp = 0;
+	bool found = false;
+
+	for (int i = 0; i < count; i++)
+	{
+		struct stat st;
+		if (stat(fnames[i], &st) != 0)
+			continue;
+
+		found = true;
+		stamp = (stamp ^ uint64_t(st.st_size)) * UINT64_C(0x100000001B3);
+		stamp = (stamp ^ uint64_t(st.st_mtime)) * UINT64_C(0x100000001B3);
+	}
+	return found ? stamp | 1 : 0;
+}
+
+
+const void* EvalImage::map(const std::string& fname, const char* tag, uint64_t stamp, size_t bytes) {
+
+	size_t fileBytes;
+	const char* p = map_file(fname, fileBytes);
+	if (!p)
+		return NULL;
+
+	const ImageHeader& h = *reinterpret_cast<const ImageHeader*>(p);
+
+	if (   fileBytes != HeaderBytes + bytes
+		|| !valid_header(h, tag, stamp, bytes)
+		|| h.checksum != checksum(p + HeaderBytes, bytes))
+	{
+		unmap_file(p, fileBytes);
+		return NULL;
+	}
+
+#if !defined(_MSC_VER) && !defined(_WIN32) && defined(MADV_RANDOM)
+	// The evaluation reads the tables at random, don't read ahead
+	madvise(const_cast<char*>(p), fileBytes, MADV_RANDOM);
+#endif
+	return p + HeaderBytes;
+}
+
+
+bool EvalImage::write(const std::string& fname, const char* tag, uint64_t stamp, const void* data, size_t bytes) {
+
+	std::ostringstream tmp;
+#if defined(_MSC_VER) || defined(_WIN32)
+	tmp << fname << ".tmp" << GetCurrentProcessId();
+#else
+	tmp << fname << ".tmp" << getpid();
+#endif
+
+	char header[HeaderBytes];
+	memset(header, 0, sizeof(header));
+	fill_header(*reinterpret_cast<ImageHeader*>(header), tag, stamp, data, bytes);
+
+	FILE* fp = fopen(tmp.str().c_str(), "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+
+	// Write in chunks, a single fwrite() of several hundred MB is not portable
+	const size_t Chunk = 16 * 1024 * 1024;
+	for (size_t i = 0; ok && i < bytes; i += Chunk)
+	{
+		size_t n = bytes - i < Chunk ? bytes - i : Chunk;
+		ok = fwrite(static_cast<const char*>(data) + i, 1, n, fp) == n;
+	}
+	ok = (fclose(fp) == 0) && ok;
+
+#if defined(_MSC_VER) || defined(_WIN32)
+	ok = ok && MoveFileExA(tmp.str().c_str(), fname.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && rename(tmp.str().c_str(), fname.c_str()) == 0;
+#endif
+
+	if (!ok)
+		remove(tmp.str().c_str());
+
+	return ok;
+}
+
+
+const void* EvalImage::load(const std::string& fname, const char* tag, const char* const sources[],
+                            int sourceCount, size_t bytes, bool (*convert)(void* data)) {
+
+	const uint64_t stamp = source_stamp(sources, sourceCount);
+
+	const void* p = map(fname, tag, stamp, bytes);
+	if (p)
+		return p;
+
+	// Build the weights from the original files. The buffer is aligned like
+	// the payload of a mapped image.
+	char* mem = static_cast<char*>(malloc(bytes + 63));
+	char* data = reinterpret_cast<char*>((uintptr_t(mem) + 63) & ~uintptr_t(63));
+
+	if (!mem || !convert(data))
+	{
+		free(mem);
+		return NULL;
+	}
+
+	// Map the new image so that the following engines share it with us
+	if (write(fname, tag, stamp, data, bytes) && (p = map(fname, tag, stamp, bytes)) != NULL)
+	{
+		free(mem);
+		return p;
+	}
+	return data;
+}
@@ -0,0 +1,76 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(EVALIMAGE_H_INCLUDED)
+#define EVALIMAGE_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+
+/// An evaluation image is a file holding the weights of an evaluator exactly
+/// as they are laid out in memory, after any conversion done at load time.
+/// It is mapped read-only, so that the engine starts without reading or
+/// converting anything and all the engines running on a host share one copy
+/// of the weights in the page cache.
+///
+/// The file starts with an ImageHeader, the weights follow at offset 64.
+/// The tag names the evaluator and the layout of the weights, the source
+/// stamp identifies the original weight files the image was built from.
+
+namespace EvalImage {
+
+	struct ImageHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t headerBytes;
+		char tag[16];
+		uint64_t sourceStamp;
+		uint64_t payloadBytes;
+		uint64_t checksum;
+		uint64_t reserved;
+	};
+
+	/// source_stamp() returns a value that changes whenever one of the given
+	/// files is replaced, or 0 if none of them exists.
+	uint64_t source_stamp(const char* const fnames[], int count);
+
+	/// map() maps the image 'fname' and returns a pointer to its weights, or
+	/// NULL if the file is missing, was built for another tag or size, is
+	/// corrupt, or is stale (its stamp differs from a non zero 'stamp').
+	/// The mapping is kept until the process exits.
+	const void* map(const std::string& fname, const char* tag, uint64_t stamp, size_t bytes);
+
+	/// write() saves the weights 'data' as the image 'fname'. The file is
+	/// written under a temporary name and then renamed, so that an engine
+	/// starting at the same time never maps a partial image.
+	bool write(const std::string& fname, const char* tag, uint64_t stamp, const void* data, size_t bytes);
+
+	/// load() returns the weights of an evaluator: they are mapped from the
+	/// image when it is valid, otherwise 'convert' fills a fresh buffer from
+	/// the original files, the image is rebuilt and mapped instead. The buffer
+	/// is kept when the image can't be written. Returns NULL when 'convert'
+	/// fails.
+	const void* load(const std::string& fname, const char* tag, const char* const sources[],
+	                 int sourceCount, size_t bytes, bool (*convert)(void* data));
+}
+
+#endif // !defined(EVALIMAGE_H_INCLUDED)
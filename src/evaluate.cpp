@@ -23,16 +23,27 @@
 
 #include "position.h"
 #include "evaluate.h"
+#include "evalimage.h"
 
 // ]֐֘A`
 #define EVAL_SQUARE
 
+// ̃t@C Makefile  -DEVAL_NANO  -DEVAL_MINI t2RpCA
+// ꂼ EVALTYPE_NANO  EVALTYPE_MINI ̕]֐ɂ
 #if defined(EVAL_NANO)
 #include "param_nano.h"
+#define EVAL_THIS EVALTYPE_NANO
 #define FV_BIN "fv_nano.bin"
+#define FV_IMG "fv_nano.img"
+#define FV_TAG "nano"
 #elif defined(EVAL_MINI)
 #include "param_mini.h"
+#define EVAL_THIS EVALTYPE_MINI
 #define FV_BIN "fv_mini.bin"
+#define FV_IMG "fv_mini.img"
+#define FV_TAG "mini"
+#else
+#error "evaluate.cpp needs -DEVAL_NANO or -DEVAL_MINI"
 #endif
 #define NLIST	38
 
@@ -48,8 +59,12 @@
 #define Inv(sq)             (nsquare-1-sq)
 #define PcOnSq(k,i)         fv_kp[k][i]
 #if !defined(EVAL_NANO)
+#if defined(EVAL_SQUARE)
+#define PcPcOn(i,j)         fv_pp[pp_index(i,j)]
+#else
 #define PcPcOn(i,j)         fv_pp[i][j]
 #endif
+#endif
 
 #define I2HandPawn(hand)    (((hand) & HAND_FU_MASK) >> HAND_FU_SHIFT)
 #define I2HandLance(hand)   (((hand) & HAND_KY_MASK) >> HAND_KY_SHIFT)
@@ -128,35 +143,115 @@ enum {
 	kp_end          = 1476
 };
 
+#if defined(EVAL_SQUARE)
+// PP ͑Ώ̂Ȃ̂ (i, j)  (j, i) 1ɂ܂Ƃ߁Ai >= j ̎Op`̕
+enum { pp_n = pp_end * ( pp_end + 1 ) / 2 };
+
+inline int pp_index(const int i, const int j)
+{
+	return i >= j ? i * ( i + 1 ) / 2 + j : j * ( j + 1 ) / 2 + i;
+}
+
+// Op`̔zuł̍s i ̐擪(i >= j  (i, j) ͂Aĕ)
+inline int pp_row(const int i)
+{
+	return i * ( i + 1 ) / 2;
+}
+#endif
+
 namespace {
-	short p_value[31];
+	// ]xNg. ϊς݂̃C[W(FV_IMG)}bvĎg.
+	// C[W̃CAEg͂̍\̂̂
+	struct Weights {
+#if !defined(EVAL_NANO)
+#if defined(EVAL_SQUARE)
+		short pp[pp_n];
+#else
+		short pp[pp_bend][pp_end];
+#endif
+#endif
+		CACHE_LINE_ALIGNMENT short kp[nsquare][kp_end];
+	};
 
 #if !defined(EVAL_NANO)
 #if defined(EVAL_SQUARE)
-	short fv_pp[pp_end][pp_end];
+	const short* fv_pp;
 #else
-	short fv_pp[pp_bend][pp_end];
+	const short (*fv_pp)[pp_end];
 #endif
 #endif
-	short fv_kp[nsquare][kp_end];
-}
+	const short (*fv_kp)[kp_end];
 
-namespace NanohaTbl {
-	const short z2sq[] = {
-		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-		-1,  0,  9, 18, 27, 36, 45, 54, 63, 72, -1, -1, -1, -1, -1, -1,
-		-1,  1, 10, 19, 28, 37, 46, 55, 64, 73, -1, -1, -1, -1, -1, -1,
-		-1,  2, 11, 20, 29, 38, 47, 56, 65, 74, -1, -1, -1, -1, -1, -1,
-		-1,  3, 12, 21, 30, 39, 48, 57, 66, 75, -1, -1, -1, -1, -1, -1,
-		-1,  4, 13, 22, 31, 40, 49, 58, 67, 76, -1, -1, -1, -1, -1, -1,
-		-1,  5, 14, 23, 32, 41, 50, 59, 68, 77, -1, -1, -1, -1, -1, -1,
-		-1,  6, 15, 24, 33, 42, 51, 60, 69, 78, -1, -1, -1, -1, -1, -1,
-		-1,  7, 16, 25, 34, 43, 52, 61, 70, 79, -1, -1, -1, -1, -1, -1,
-		-1,  8, 17, 26, 35, 44, 53, 62, 71, 80, -1, -1, -1, -1, -1, -1,
+#if defined(EVAL_SQUARE)
+	// ށPP/KP̃CfbNX(ɏڂ̔ԍ𑫂)
+	const int pp_tbl[32] = {
+		-1, pp_bpawn, pp_blance, pp_bknight, pp_bsilver, pp_bgold, pp_bbishop, pp_brook,
+		-1, pp_bgold, pp_bgold,  pp_bgold,   pp_bgold,   -1,       pp_bhorse,  pp_bdragon,
+		-1, pp_wpawn, pp_wlance, pp_wknight, pp_wsilver, pp_wgold, pp_wbishop, pp_wrook,
+		-1, pp_wgold, pp_wgold,  pp_wgold,   pp_wgold,   -1,       pp_whorse,  pp_wdragon,
+	};
+	const int kp_tbl[32] = {
+		-1, kp_bpawn, kp_blance, kp_bknight, kp_bsilver, kp_bgold, kp_bbishop, kp_brook,
+		-1, kp_bgold, kp_bgold,  kp_bgold,   kp_bgold,   -1,       kp_bhorse,  kp_bdragon,
+		-1, kp_wpawn, kp_wlance, kp_wknight, kp_wsilver, kp_wgold, kp_wbishop, kp_wrook,
+		-1, kp_wgold, kp_wgold,  kp_wgold,   kp_wgold,   -1,       kp_whorse,  kp_wdragon,
+	};
+#endif
+
+	// ̎ށK(P+H)̃CfbNX(ɖ𑫂)
+	const int kp_hand_btbl[8] = {
+		-1, kp_hand_bpawn, kp_hand_blance, kp_hand_bknight, kp_hand_bsilver, kp_hand_bgold, kp_hand_bbishop, kp_hand_brook,
+	};
+	const int kp_hand_wtbl[8] = {
+		-1, kp_hand_wpawn, kp_hand_wlance, kp_hand_wknight, kp_hand_wsilver, kp_hand_wgold, kp_hand_wbishop, kp_hand_wrook,
+	};
+	const uint32_t hand_mask[8] = {
+		0, HAND_FU_MASK, HAND_KY_MASK, HAND_KE_MASK, HAND_GI_MASK, HAND_KI_MASK, HAND_KA_MASK, HAND_HI_MASK,
+	};
+	const int hand_shift[8] = {
+		0, HAND_FU_SHIFT, HAND_KY_SHIFT, HAND_KE_SHIFT, HAND_GI_SHIFT, HAND_KI_SHIFT, HAND_KA_SHIFT, HAND_HI_SHIFT,
 	};
-}
+
+	//  pt  K(P+H) ̒l(ʕ). sq_bk1 ͔]ʂ̈ʒu.
+	inline int kp_hand(const int sq_bk0, const int sq_bk1, const int pt, const uint32_t handB, const uint32_t handW)
+	{
+		const int nb = (handB & hand_mask[pt]) >> hand_shift[pt];
+		const int nw = (handW & hand_mask[pt]) >> hand_shift[pt];
+		return fv_kp[sq_bk0][kp_hand_btbl[pt] + nb] + fv_kp[sq_bk0][kp_hand_wtbl[pt] + nw]
+		     - fv_kp[sq_bk1][kp_hand_btbl[pt] + nw] - fv_kp[sq_bk1][kp_hand_wtbl[pt] + nb];
+	}
 
 #if defined(EVAL_SQUARE)
+	// Տ̋ piece(sq)  KP ̒l(ʕ).
+	inline int kp_board(const int sq_bk0, const int sq_bk1, const int piece, const int sq)
+	{
+		return PcOnSq(sq_bk0, kp_tbl[piece] + sq) - PcOnSq(sq_bk1, kp_tbl[piece ^ GOTE] + Inv(sq));
+	}
+
+#if !defined(EVAL_NANO)
+	// PP ̃Xgԍ̏ɕבւ. Xgɓԍ2Ȃ̂ŁArbg
+	// ĂĂ珬Ɏo
+	void sort_list(int list[], const int nlist)
+	{
+		uint32_t bits[(pp_end + 31) / 32] = { 0 };
+		for (int i = 0; i < nlist; i++) {
+			bits[list[i] >> 5] |= 1u << (list[i] & 31);
+		}
+		int n = 0;
+		for (int i = 0; i < (pp_end + 31) / 32; i++) {
+			unsigned long b = bits[i], id;
+			while (_BitScanForward(&id, b)) {
+				list[n++] = i * 32 + int(id);
+				b &= b - 1;
+			}
+		}
+		assert(n == nlist);
+	}
+#endif
+#endif
+}
+
+#if defined(EVAL_SQUARE) && !defined(EVAL_NANO)
 namespace {
 	void conv_pp(short pp[pp_end][pp_end], short pp_ori[pp_bend][pp_end])
 	{
@@ -234,58 +329,93 @@ namespace {
 			}
 		}
 #endif
+		// vZ͋̑g̏ԂɂȂƂOɂĂ̂ŁAΏ̂ɂ낦
+		for (int sq1 = 0; sq1 < pp_end; sq1++) {
+			for (int sq2 = sq1 + 1; sq2 < pp_end; sq2++) {
+				pp[sq2][sq1] = pp[sq1][sq2];
+			}
+		}
+	}
+
+	// Ώ̂ PP  i >= j ̕Op`̔zuɋl߂
+	void fold_pp(short pp_tri[pp_n], short pp[pp_end][pp_end])
+	{
+		for (int i = 0; i < pp_end; i++) {
+			for (int j = 0; j <= i; j++) {
+				pp_tri[pp_index(i, j)] = pp[i][j];
+			}
+		}
 	}
 }
 #endif
 
-void Position::init_evaluate()
-{
-	int iret=0;
-	FILE *fp;
-	const char *fname ="]xNg";
+namespace {
+	// FV_BIN ǂŕ]xNggݗĂ. C[WȂÂƂĂ΂
+	bool read_weights(void* data)
+	{
+		Weights& w = *static_cast<Weights*>(data);
+		int iret=0;
+		FILE *fp;
 
-	do {
-		size_t size;
+		do {
+			size_t size;
 
-		fname = FV_BIN;
-		fp = fopen(fname, "rb");
-		if ( fp == NULL ) { iret = -2; break;}
+			fp = fopen(FV_BIN, "rb");
+			if ( fp == NULL ) { iret = -2; break;}
 
 #if !defined(EVAL_NANO)
-		size = pp_bend * pp_end;
+			size = pp_bend * pp_end;
 #if defined(EVAL_SQUARE)
-		short (*p)[pp_end] = (short (*)[pp_end])malloc(sizeof(short)*size);
-		if (p == NULL) { iret = -2; break;}
-		if ( fread( p, sizeof(short), size, fp ) != size )
-		{
-			iret = -2;
-			break;
-		}
-		conv_pp(fv_pp, p);
-		free(p);
+			short (*p)[pp_end] = (short (*)[pp_end])malloc(sizeof(short)*size);
+			short (*pp)[pp_end] = (short (*)[pp_end])malloc(sizeof(short)*pp_end*pp_end);
+			if (p == NULL || pp == NULL) { free(p); free(pp); iret = -2; break;}
+			if ( fread( p, sizeof(short), size, fp ) != size )
+			{
+				free(p);
+				free(pp);
+				iret = -2;
+				break;
+			}
+			conv_pp(pp, p);
+			fold_pp(w.pp, pp);
+			free(p);
+			free(pp);
 #else
-		if ( fread( fv_pp, sizeof(short), size, fp ) != size )
-		{
-			iret = -2;
-			break;
-		}
+			if ( fread( w.pp, sizeof(short), size, fp ) != size )
+			{
+				iret = -2;
+				break;
+			}
 #endif
 #endif
 
-		size = nsquare * kp_end;
-		if ( fread( fv_kp, sizeof(short), size, fp ) != size ) {
-			iret = -2;
-			break;
-		}
+			size = nsquare * kp_end;
+			if ( fread( w.kp, sizeof(short), size, fp ) != size ) {
+				iret = -2;
+				break;
+			}
 
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
-		}
-	} while (0);
-	if (fp) fclose( fp );
+			if (fgetc(fp) != EOF) {
+				iret = -2;
+				break;
+			}
+		} while (0);
+		if (fp) fclose( fp );
+
+		return iret >= 0;
+	}
+}
 
-	if (iret < 0) {
+template<>
+void Position::init_evaluate<EVAL_THIS>()
+{
+	static const Weights Empty = {};	// ǂ߂ȂƂ͋肾ŕ]
+	const char* const sources[] = { FV_BIN };
+	const Weights* w = static_cast<const Weights*>(
+		EvalImage::load(FV_IMG, FV_TAG, sources, 1, sizeof(Weights), read_weights));
+
+	if (w == NULL) {
+		w = &Empty;
 //#if !defined(NDEBUG)
 		std::cerr << "Can't load " FV_BIN "." << std::endl;
 //#endif
@@ -294,122 +424,24 @@ void Position::init_evaluate()
 		exit(1);
 #endif	// defined(CSA_DLL) || defined(CSA_DIRECT)
 	}
-
-	for (int i = 0; i < 31; i++) { p_value[i]       = 0; }
-
-	p_value[15+pawn]       = DPawn;
-	p_value[15+lance]      = DLance;
-	p_value[15+knight]     = DKnight;
-	p_value[15+silver]     = DSilver;
-	p_value[15+gold]       = DGold;
-	p_value[15+bishop]     = DBishop;
-	p_value[15+rook]       = DRook;
-	p_value[15+king]       = DKing;
-	p_value[15+pro_pawn]   = DProPawn;
-	p_value[15+pro_lance]  = DProLance;
-	p_value[15+pro_knight] = DProKnight;
-	p_value[15+pro_silver] = DProSilver;
-	p_value[15+horse]      = DHorse;
-	p_value[15+dragon]     = DDragon;
-
-	p_value[15-pawn]          = p_value[15+pawn];
-	p_value[15-lance]         = p_value[15+lance];
-	p_value[15-knight]        = p_value[15+knight];
-	p_value[15-silver]        = p_value[15+silver];
-	p_value[15-gold]          = p_value[15+gold];
-	p_value[15-bishop]        = p_value[15+bishop];
-	p_value[15-rook]          = p_value[15+rook];
-	p_value[15-king]          = p_value[15+king];
-	p_value[15-pro_pawn]      = p_value[15+pro_pawn];
-	p_value[15-pro_lance]     = p_value[15+pro_lance];
-	p_value[15-pro_knight]    = p_value[15+pro_knight];
-	p_value[15-pro_silver]    = p_value[15+pro_silver];
-	p_value[15-horse]         = p_value[15+horse];
-	p_value[15-dragon]        = p_value[15+dragon];
+#if !defined(EVAL_NANO)
+	fv_pp = w->pp;
+#endif
+	fv_kp = w->kp;
 }
 
-int Position::compute_material() const
+template<>
+const int* Position::piece_values<EVAL_THIS>()
 {
-	int v, item, itemp;
-	int i;
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_FU; i <= KNE_FU; i++) {
-		if (knkind[i] == SFU) item++;
-		if (knkind[i] == GFU) item--;
-		if (knkind[i] == STO) itemp++;
-		if (knkind[i] == GTO) itemp--;
-	}
-	v  = item  * p_value[15+pawn];
-	v += itemp * p_value[15+pro_pawn];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KY; i <= KNE_KY; i++) {
-		if (knkind[i] == SKY) item++;
-		if (knkind[i] == GKY) item--;
-		if (knkind[i] == SNY) itemp++;
-		if (knkind[i] == GNY) itemp--;
-	}
-	v += item  * p_value[15+lance];
-	v += itemp * p_value[15+pro_lance];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KE; i <= KNE_KE; i++) {
-		if (knkind[i] == SKE) item++;
-		if (knkind[i] == GKE) item--;
-		if (knkind[i] == SNK) itemp++;
-		if (knkind[i] == GNK) itemp--;
-	}
-	v += item  * p_value[15+knight];
-	v += itemp * p_value[15+pro_knight];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_GI; i <= KNE_GI; i++) {
-		if (knkind[i] == SGI) item++;
-		if (knkind[i] == GGI) item--;
-		if (knkind[i] == SNG) itemp++;
-		if (knkind[i] == GNG) itemp--;
-	}
-	v += item  * p_value[15+silver];
-	v += itemp * p_value[15+pro_silver];
-
-	item  = 0;
-	for (i = KNS_KI; i <= KNE_KI; i++) {
-		if (knkind[i] == SKI) item++;
-		if (knkind[i] == GKI) item--;
-	}
-	v += item  * p_value[15+gold];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KA; i <= KNE_KA; i++) {
-		if (knkind[i] == SKA) item++;
-		if (knkind[i] == GKA) item--;
-		if (knkind[i] == SUM) itemp++;
-		if (knkind[i] == GUM) itemp--;
-	}
-	v += item  * p_value[15+bishop];
-	v += itemp * p_value[15+horse];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_HI; i <= KNE_HI; i++) {
-		if (knkind[i] == SHI) item++;
-		if (knkind[i] == GHI) item--;
-		if (knkind[i] == SRY) itemp++;
-		if (knkind[i] == GRY) itemp--;
-	}
-	v += item  * p_value[15+rook];
-	v += itemp * p_value[15+dragon];
-
+	static const int v[16] = {
+		0, DPawn, DLance, DKnight, DSilver, DGold, DBishop, DRook,
+		DKing, DProPawn, DProLance, DProKnight, DProSilver, 0, DHorse, DDragon,
+	};
 	return v;
 }
 
-int Position::make_list(int * pscore, int list0[NLIST], int list1[NLIST] ) const
+template<>
+int Position::make_list<EVAL_THIS>(int * pscore, int list0[NLIST], int list1[NLIST] ) const
 {
 	int sq, i, score, sq_bk0, sq_bk1;
 
@@ -418,18 +450,6 @@ int Position::make_list(int * pscore, int list0[NLIST], int list1[NLIST] ) const
 	sq_bk1 = Inv(SQ_WKING);
 
 #if defined(EVAL_SQUARE)
-	static const int pp_tbl[32] = {
-		-1, pp_bpawn, pp_blance, pp_bknight, pp_bsilver, pp_bgold, pp_bbishop, pp_brook,
-		-1, pp_bgold, pp_bgold,  pp_bgold,   pp_bgold,   -1,       pp_bhorse,  pp_bdragon,
-		-1, pp_wpawn, pp_wlance, pp_wknight, pp_wsilver, pp_wgold, pp_wbishop, pp_wrook,
-		-1, pp_wgold, pp_wgold,  pp_wgold,   pp_wgold,   -1,       pp_whorse,  pp_wdragon,
-	};
-	static const int kp_tbl[32] = {
-		-1, kp_bpawn, kp_blance, kp_bknight, kp_bsilver, kp_bgold, kp_bbishop, kp_brook,
-		-1, kp_bgold, kp_bgold,  kp_bgold,   kp_bgold,   -1,       kp_bhorse,  kp_bdragon,
-		-1, kp_wpawn, kp_wlance, kp_wknight, kp_wsilver, kp_wgold, kp_wbishop, kp_wrook,
-		-1, kp_wgold, kp_wgold,  kp_wgold,   kp_wgold,   -1,       kp_whorse,  kp_wdragon,
-	};
 	// ԍF1`2ʁA3`40ʈȊO
 	int nlist  = 0;
 	for (int kn = 3; kn <= 40; kn++) {
@@ -442,6 +462,9 @@ int Position::make_list(int * pscore, int list0[NLIST], int list1[NLIST] ) const
 		score += PcOnSq(sq_bk0, kp_tbl[knkind[kn]       ] + sq);
 		score -= PcOnSq(sq_bk1, kp_tbl[knkind[kn] ^ GOTE] + Inv(sq));
 	}
+#if !defined(EVAL_NANO)
+	sort_list(list0, nlist);
+#endif
 #else
 	int sfu_list0[9];
 	int sfu_list1[9];
@@ -754,110 +777,253 @@ int Position::make_list(int * pscore, int list0[NLIST], int list1[NLIST] ) const
 
 	assert( nlist <= NLIST );
 
-{
-	static int disp = 1;
-	if (disp) {
-		disp = 0;
-		for (i = 0; i < nlist; i++) {
-		  printf("%d ", list0[i]);
-		}
-		printf("\n");
-	}
-}
-
 	*pscore += score;
 	return nlist;
 }
 
-int Position::evaluate(const Color us) const
-{
-	int list0[NLIST], list1[NLIST];
-	int nlist, score, sq_bk, sq_wk, sum;
-	static int count=0;
-	count++;
+namespace {
+	//  KP ̘a. sq_bk ͐ʁAsq_wk ͔]ʂ̈ʒu
+	int hand_kp(const uint32_t handB, const uint32_t handW, const int sq_bk, const int sq_wk)
+	{
+		int sum = 0;
+
+		sum += fv_kp[sq_bk][kp_hand_bpawn   + I2HandPawn(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wpawn   + I2HandPawn(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_bpawn   + I2HandPawn(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wpawn   + I2HandPawn(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_blance  + I2HandLance(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wlance  + I2HandLance(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_blance  + I2HandLance(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wlance  + I2HandLance(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_bknight + I2HandKnight(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wknight + I2HandKnight(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_bknight + I2HandKnight(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wknight + I2HandKnight(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_bsilver + I2HandSilver(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wsilver + I2HandSilver(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_bsilver + I2HandSilver(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wsilver + I2HandSilver(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_bgold   + I2HandGold(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wgold   + I2HandGold(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_bgold   + I2HandGold(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wgold   + I2HandGold(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_bbishop + I2HandBishop(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wbishop + I2HandBishop(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_bbishop + I2HandBishop(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wbishop + I2HandBishop(handB)];
+
+		sum += fv_kp[sq_bk][kp_hand_brook   + I2HandRook(handB)];
+		sum += fv_kp[sq_bk][kp_hand_wrook   + I2HandRook(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_brook   + I2HandRook(handW)];
+		sum -= fv_kp[sq_wk][kp_hand_wrook   + I2HandRook(handB)];
+
+		return sum;
+	}
 
-	sum = 0;
-	sq_bk = SQ_BKING;
-	sq_wk = Inv( SQ_WKING );
+	// make_list() ̃Xg PP ̘a
+	int pp_sum(const int list0[], const int list1[], const int nlist)
+	{
+		int sum = 0;
 
-	sum += fv_kp[sq_bk][kp_hand_bpawn   + I2HandPawn(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wpawn   + I2HandPawn(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_bpawn   + I2HandPawn(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wpawn   + I2HandPawn(HAND_B)];
+#if defined(EVAL_NANO)
+		(void)list0;	// PP Ȃ
+		(void)list1;
+		(void)nlist;
+#else
+#if defined(EVAL_SQUARE)
+		(void)list1;
+		// list0 ͏Ȃ̂ŁAg (list0[i], list0[j]) (j < i) ͍s list0[i] ̒O珇ɎQƂ
+		for (int i = 1; i < nlist; i++ )
+		{
+			const short* row = fv_pp + pp_row(list0[i]);
+			assert(list0[i - 1] < list0[i]);
+			for (int j = 0; j < i; j++ )
+			{
+				sum += row[list0[j]];
+			}
+		}
+#else
+		int i;
+		for (i = 0; list0[i] < pp_bend; i++ )
+		{
+			assert(i < nlist);
+			const int k0 = list0[i];
+			for (int j = i+1; j < nlist; j++ )
+			{
+				const int l0 = list0[j];
+				sum += PcPcOn( k0, l0 );
+			}
+		}
 
-	sum += fv_kp[sq_bk][kp_hand_blance  + I2HandLance(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wlance  + I2HandLance(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_blance  + I2HandLance(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wlance  + I2HandLance(HAND_B)];
+		for ( ; i < nlist; i++ )
+		{
+			const int k1 = list1[i];
+			assert(k1 < pp_bend);
+			for (int j = i+1; j < nlist; j++ )
+			{
+				const int l1 = list1[j];
+				sum -= PcPcOn( k1, l1 );
+			}
+		}
+#endif
+#endif
+
+		return sum;
+	}
+}
+
+/// Position::compute_eval_sums()  KP(܂) PP ̘aꂩvZ.
+/// ǖʂ̐ݒ莞ƋʂƂɎgAȊO do_move() ōXV.
 
-	sum += fv_kp[sq_bk][kp_hand_bknight + I2HandKnight(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wknight + I2HandKnight(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_bknight + I2HandKnight(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wknight + I2HandKnight(HAND_B)];
+template<>
+void Position::compute_eval_sums<EVAL_THIS>(int evalSum[3]) const
+{
+	int list0[NLIST], list1[NLIST];
+	int nlist, score;
 
-	sum += fv_kp[sq_bk][kp_hand_bsilver + I2HandSilver(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wsilver + I2HandSilver(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_bsilver + I2HandSilver(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wsilver + I2HandSilver(HAND_B)];
+	score = hand_kp(HAND_B, HAND_W, SQ_BKING, Inv(SQ_WKING));
+	nlist = make_list<EVAL_THIS>( &score, list0, list1 );
 
-	sum += fv_kp[sq_bk][kp_hand_bgold   + I2HandGold(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wgold   + I2HandGold(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_bgold   + I2HandGold(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wgold   + I2HandGold(HAND_B)];
+	evalSum[1] = pp_sum(list0, list1, nlist);
+	evalSum[0] = score;
+}
 
-	sum += fv_kp[sq_bk][kp_hand_bbishop + I2HandBishop(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wbishop + I2HandBishop(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_bbishop + I2HandBishop(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wbishop + I2HandBishop(HAND_B)];
+/// Position::eval_stage()  compute_eval_sums() ̊e1s(bench eval p).
 
-	sum += fv_kp[sq_bk][kp_hand_brook   + I2HandRook(HAND_B)];
-	sum += fv_kp[sq_bk][kp_hand_wrook   + I2HandRook(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_brook   + I2HandRook(HAND_W)];
-	sum -= fv_kp[sq_wk][kp_hand_wrook   + I2HandRook(HAND_B)];
+template<>
+int Position::eval_stage<EVAL_THIS>(EvalStage stage, EvalScratch& w) const
+{
+	int score = 0;
+
+	switch (stage) {
+	case EVAL_STAGE_HAND:
+		return hand_kp(HAND_B, HAND_W, SQ_BKING, Inv(SQ_WKING));
+	case EVAL_STAGE_LIST:
+		w.nhand = 0;
+		w.nlist = make_list<EVAL_THIS>(&score, w.list0, w.list1);
+		return score;
+	case EVAL_STAGE_SUMS:
+		return pp_sum(w.list0, w.list1, w.nlist);
+	case EVAL_STAGE_MATERIAL:		// ]֐ɂȂ. Position::eval_stage() s
+	case EVAL_STAGE_NB:
+	default:
+		assert(false);
+		return 0;
+	}
+}
 
+/// Position::update_eval_sums()  StateInfo  KP  PP ̘a߂. Őǖʂ
+/// aĂ΁Aω͓̂(Ǝ)̍Ȃ̂ŁAՏ̋
+/// 1Ȃ߂邾ōς. ʂƂƒŐǖʂ̘aȂƂ͈ꂩvZ.
+/// lݒT̂悤 evaluate() Ă΂Ȃǖʂł͉Ȃčςނ悤Ado_move()
+/// ł͌vZɂŒxċ߂.
 
-	score = 0;
-	nlist = make_list( &score, list0, list1 );
+template<>
+void Position::update_eval_sums<EVAL_THIS>() const
+{
+	const StateInfo* prev = st->previous;
+	const Move m = st->lastMove;
 
-#if !defined(EVAL_NANO)
 #if defined(EVAL_SQUARE)
-	for (int i = 0; i < nlist; i++ )
+	if (prev == NULL || prev->evalSum[0] == EVAL_SUM_NONE || m == MOVE_NONE
+	 || move_piece(m) == SOU || move_piece(m) == GOU)
+#endif
 	{
-		assert(i < nlist);
-		const int k0 = list0[i];
-		for (int j = i+1; j < nlist; j++ )
-		{
-			const int l0 = list0[j];
-			sum += PcPcOn( k0, l0 );
-		}
+		compute_eval_sums<EVAL_THIS>(st->evalSum);
+		return;
 	}
-#else
-	int i;
-	for (i = 0; list0[i] < pp_bend; i++ )
-	{
-		assert(i < nlist);
-		const int k0 = list0[i];
-		for (int j = i+1; j < nlist; j++ )
-		{
-			const int l0 = list0[j];
-			sum += PcPcOn( k0, l0 );
+
+#if defined(EVAL_SQUARE)
+	const int sq_bk0 = SQ_BKING;
+	const int sq_bk1 = Inv(SQ_WKING);
+	const int from = move_from(m);
+	const int to = move_to(m);
+	const int sqTo = NanohaTbl::z2sq[to];
+	const Piece before = move_piece(m);		// wŐ(ł)
+	const Piece after = piece_on(Square(to));	// w̋
+	const Piece capture = st->captured;
+	uint32_t handB = HAND_B;
+	uint32_t handW = HAND_W;
+
+	int kp = kp_board(sq_bk0, sq_bk1, after, sqTo);
+	if (from == 0) {
+		// łF1
+		const int pt = before & ~GOTE;
+		kp += kp_hand(sq_bk0, sq_bk1, pt, handB, handW);
+		if (before & GOTE) handW += Hand::tbl[pt];
+		else               handB += Hand::tbl[pt];
+		kp -= kp_hand(sq_bk0, sq_bk1, pt, handB, handW);
+	} else {
+		kp -= kp_board(sq_bk0, sq_bk1, before, NanohaTbl::z2sq[from]);
+		if (capture) {
+			// FՏォĎ1
+			const int pt = capture & ~(GOTE | PROMOTED);
+			kp -= kp_board(sq_bk0, sq_bk1, capture, sqTo);
+			kp += kp_hand(sq_bk0, sq_bk1, pt, handB, handW);
+			if (before & GOTE) handW -= Hand::tbl[pt];
+			else               handB -= Hand::tbl[pt];
+			kp -= kp_hand(sq_bk0, sq_bk1, pt, handB, handW);
 		}
 	}
 
-	for ( ; i < nlist; i++ )
-	{
-		const int k1 = list1[i];
-		assert(k1 < pp_bend);
-		for (int j = i+1; j < nlist; j++ )
-		{
-			const int l1 = list1[j];
-			sum -= PcPcOn( k1, l1 );
+#if defined(EVAL_NANO)
+	st->evalSum[1] = prev->evalSum[1];
+#else
+	// fv_pp ͑Ώ̂ɂĂ̂ŁȂg̏(ԍ)͋CɂȂĂ悢
+	const int iAfter = pp_tbl[after] + sqTo;
+	int pp = 0;
+	if (from == 0) {
+		for (int kn = 3; kn <= 40; kn++) {
+			const int z = knpos[kn];
+			if (!OnBoard(z) || z == to) continue;	// Ƒł
+			pp += PcPcOn(iAfter, pp_tbl[knkind[kn]] + NanohaTbl::z2sq[z]);
+		}
+	} else if (capture) {
+		const int iBefore = pp_tbl[before] + NanohaTbl::z2sq[from];
+		const int iCapture = pp_tbl[capture] + sqTo;
+		pp -= PcPcOn(iBefore, iCapture);
+		for (int kn = 3; kn <= 40; kn++) {
+			const int z = knpos[kn];
+			if (!OnBoard(z) || z == to) continue;
+			const int j = pp_tbl[knkind[kn]] + NanohaTbl::z2sq[z];
+			pp += PcPcOn(iAfter, j) - PcPcOn(iBefore, j) - PcPcOn(iCapture, j);
+		}
+	} else {
+		const int iBefore = pp_tbl[before] + NanohaTbl::z2sq[from];
+		for (int kn = 3; kn <= 40; kn++) {
+			const int z = knpos[kn];
+			if (!OnBoard(z) || z == to) continue;
+			const int j = pp_tbl[knkind[kn]] + NanohaTbl::z2sq[z];
+			pp += PcPcOn(iAfter, j) - PcPcOn(iBefore, j);
 		}
 	}
+	st->evalSum[1] = prev->evalSum[1] + pp;
 #endif
+	// ̃XbhǖʂQƂ邱Ƃ̂ŁAvZ͍̈Ōɏ
+	st->evalSum[0] = prev->evalSum[0] + kp;
+#endif
+}
+
+template<>
+int Position::evaluate<EVAL_THIS>(const Color us) const
+{
+	int score;
+
+	if (st->evalSum[0] == EVAL_SUM_NONE)
+		update_eval_sums<EVAL_THIS>();
+
+#if !defined(NDEBUG)
+	int evalSum[3];
+	compute_eval_sums<EVAL_THIS>(evalSum);
+	assert(evalSum[0] == st->evalSum[0] && evalSum[1] == st->evalSum[1]);
 #endif
 
-	score += sum;
+	score = st->evalSum[0] + st->evalSum[1];
 	score /= FV_SCALE;
 
 	score += MATERIAL;
@@ -866,10 +1032,3 @@ int Position::evaluate(const Color us) const
 
 	return score;
 }
-
-Value evaluate(const Position& pos, Value& margin)
-{
-	margin = VALUE_ZERO;
-	const Color us = pos.side_to_move();
-	return Value(pos.evaluate(us));
-}
@@ -21,10 +21,68 @@
 #if !defined(EVALUATE_H_INCLUDED)
 #define EVALUATE_H_INCLUDED
 
+#include <string>
+
 #include "types.h"
 
 class Position;
 
+#if defined(NANOHA)
+/// EvalType names the evaluation functions built into the engine. All of them
+/// are compiled in, the USI option "EvalType" selects one by name and the
+/// Makefile (EVAL_DEFAULT) chooses the default one.
+
+enum EvalType {
+	EVALTYPE_NANO,		// "nano":  KP
+	EVALTYPE_MINI,		// "mini":  KP + PP
+	EVALTYPE_APERY,		// "apery": KK + KKP + KPP
+	EVALTYPE_NNUE,		// "nnue":  HalfKP neural network
+	EVALTYPE_NB
+};
+
+#if defined(EVAL_DEFAULT_NANO)
+#define EVAL_DEFAULT_NAME "nano"
+#elif defined(EVAL_DEFAULT_APERY)
+#define EVAL_DEFAULT_NAME "apery"
+#elif defined(EVAL_DEFAULT_NNUE)
+#define EVAL_DEFAULT_NAME "nnue"
+#else
+#define EVAL_DEFAULT_NAME "mini"
+#endif
+
+/// EvalStage names the parts of a full evaluation, which "bench eval" times
+/// one by one. What each part does depends on the evaluation function:
+///   HAND    : the KP terms of the hands (nano, mini), the hand features (apery, nnue)
+///   LIST    : the board pieces and their KP terms (nano, mini), the board
+///             features (apery, nnue)
+///   SUMS    : the PP (mini) or KK + KKP + KPP (apery, sorting the lists first)
+///             sums over the lists, the accumulators and the network (nnue)
+///   MATERIAL: the material, computed from scratch
+/// EvalScratch carries the lists from a part to the next.
+
+enum EvalStage {
+	EVAL_STAGE_HAND,
+	EVAL_STAGE_LIST,
+	EVAL_STAGE_SUMS,
+	EVAL_STAGE_MATERIAL,
+	EVAL_STAGE_NB
+};
+
+const int EVAL_LIST_MAX = 38;	// the pieces other than the kings
+
+struct EvalScratch {
+	int list0[EVAL_LIST_MAX], list1[EVAL_LIST_MAX];
+	int nhand, nlist;
+};
+
+EvalType eval_type(const std::string& name);
+const char* eval_type_name(EvalType e);
+bool select_evaluator(const std::string& name);
+#endif
+
 Value evaluate(const Position& pos, Value& margin);
+#if defined(NANOHA)
+Value lazy_evaluate(const Position& pos, Value alpha, Value beta);
+#endif
 
 #endif // !defined(EVALUATE_H_INCLUDED)
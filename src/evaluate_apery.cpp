@@ -17,21 +17,30 @@
   You should have received a copy of the GNU General Public License
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
-#if !defined(EVAL_APERY)
-#error "Error!"
-#endif
-
 #include <cassert>
 #include <cstdio>
 
 #include "position.h"
 #include "evaluate.h"
+#include "evalimage.h"
+#include "evalfeature.h"
+
+// KPP ̘a߂ SIMD J[l. AVX2 ł͎s CPU Ďg
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define KPP_AVX2
+#if defined(__SSE2__) || defined(_M_X64)
+#define KPP_SSE2
+#endif
+#endif
 
 // ]֐֘A`
 #include "param_apery.h"
 #define FV_KK_BIN  "KK_synthesized.bin"
 #define FV_KKP_BIN "KKP_synthesized.bin"
 #define FV_KPP_BIN "KPP_synthesized.bin"
+#define FV_IMG     "apery_synthesized.img"
+#define FV_TAG     "apery"
 
 #define HANDLIST	14
 #define NLIST	(38)
@@ -40,8 +49,8 @@
 
 #define MATERIAL            (this->material)
 
-#define SQ_BKING            NanohaTbl::z2sq[kingS]
-#define SQ_WKING            NanohaTbl::z2sq[kingG]
+#define SQ_BKING            z2sq[kingS]
+#define SQ_WKING            z2sq[kingG]
 #define HAND_B              (this->hand[BLACK].h)
 #define HAND_W              (this->hand[WHITE].h)
 
@@ -56,310 +65,405 @@
 #define PcPcOnSq(k,i,j)     pc_on_sq[k][(i)*((i)+1)/2+(j)]
 #endif
 
-#define I2HandPawn(hand)    (((hand) & HAND_FU_MASK) >> HAND_FU_SHIFT)
-#define I2HandLance(hand)   (((hand) & HAND_KY_MASK) >> HAND_KY_SHIFT)
-#define I2HandKnight(hand)  (((hand) & HAND_KE_MASK) >> HAND_KE_SHIFT)
-#define I2HandSilver(hand)  (((hand) & HAND_GI_MASK) >> HAND_GI_SHIFT)
-#define I2HandGold(hand)    (((hand) & HAND_KI_MASK) >> HAND_KI_SHIFT)
-#define I2HandBishop(hand)  (((hand) & HAND_KA_MASK) >> HAND_KA_SHIFT)
-#define I2HandRook(hand)    (((hand) & HAND_HI_MASK) >> HAND_HI_SHIFT)
-
 enum {
 	promote = 8, EMPTY = 0,	/* VC++emptyԂ̂ŕύX */
 	pawn, lance, knight, silver, gold, bishop, rook, king, pro_pawn,
 	pro_lance, pro_knight, pro_silver, piece_null, horse, dragon
 };
 
-enum { nhand = 7, nfile = 9,  nrank = 9,  nsquare = 81 };
-
-// ]֐e[ũItZbgB
-// f_xxx ̋Ae_xxx G̋
-// Bonanza ̉eŎ 0 ̏ꍇ̃CfbNX݂邪AQƂ鎖͖B
-// todo:  0 ̈ʒul߂ăe[ułB(LbVɏ͏₷?)
-enum {
-	f_hand_pawn   = 0, // 0
-	e_hand_pawn   = f_hand_pawn   + 19,
-	f_hand_lance  = e_hand_pawn   + 19,
-	e_hand_lance  = f_hand_lance  +  5,
-	f_hand_knight = e_hand_lance  +  5,
-	e_hand_knight = f_hand_knight +  5,
-	f_hand_silver = e_hand_knight +  5,
-	e_hand_silver = f_hand_silver +  5,
-	f_hand_gold   = e_hand_silver +  5,
-	e_hand_gold   = f_hand_gold   +  5,
-	f_hand_bishop = e_hand_gold   +  5,
-	e_hand_bishop = f_hand_bishop +  3,
-	f_hand_rook   = e_hand_bishop +  3,
-	e_hand_rook   = f_hand_rook   +  3,
-	fe_hand_end   = e_hand_rook   +  3,
-
-	f_pawn        = fe_hand_end,
-	e_pawn        = f_pawn        + 81,
-	f_lance       = e_pawn        + 81,
-	e_lance       = f_lance       + 81,
-	f_knight      = e_lance       + 81,
-	e_knight      = f_knight      + 81,
-	f_silver      = e_knight      + 81,
-	e_silver      = f_silver      + 81,
-	f_gold        = e_silver      + 81,
-	e_gold        = f_gold        + 81,
-	f_bishop      = e_gold        + 81,
-	e_bishop      = f_bishop      + 81,
-	f_horse       = e_bishop      + 81,
-	e_horse       = f_horse       + 81,
-	f_rook        = e_horse       + 81,
-	e_rook        = f_rook        + 81,
-	f_dragon      = e_rook        + 81,
-	e_dragon      = f_dragon      + 81,
-	fe_end        = e_dragon      + 81
-};
+using namespace EvalFeature;
 
 enum { pos_n = fe_end * ( fe_end + 1 ) / 2 };
 
-namespace {
-	short p_value[31];
-
-	short fv_kpp[nsquare][fe_end][fe_end];
-	int fv_kkp[nsquare][nsquare][fe_end];
-	int fv_kk[nsquare][nsquare];
-}
-
-namespace NanohaTbl {
-	// Apery͏c^Ȃ̂ŁAϊe[uႤ
-	const short z2sq[] = {
-		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-		-1,  0,  1,  2,  3,  4,  5,  6,  7,  8, -1, -1, -1, -1, -1, -1,
-		-1,  9, 10, 11, 12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1,
-		-1, 18, 19, 20, 21, 22, 23, 24, 25, 26, -1, -1, -1, -1, -1, -1,
-		-1, 27, 28, 29, 30, 31, 32, 33, 34, 35, -1, -1, -1, -1, -1, -1,
-		-1, 36, 37, 38, 39, 40, 41, 42, 43, 44, -1, -1, -1, -1, -1, -1,
-		-1, 45, 46, 47, 48, 49, 50, 51, 52, 53, -1, -1, -1, -1, -1, -1,
-		-1, 54, 55, 56, 57, 58, 59, 60, 61, 62, -1, -1, -1, -1, -1, -1,
-		-1, 63, 64, 65, 66, 67, 68, 69, 70, 71, -1, -1, -1, -1, -1, -1,
-		-1, 72, 73, 74, 75, 76, 77, 78, 79, 80, -1, -1, -1, -1, -1, -1,
-	};
+// KPP ͑Ώ̂Ȃ̂ŁAʂ̈ʒuƂ (i, j)  (j, i) 1ɂ܂Ƃ߁Ai >= j ̎Op`̕
+inline int kpp_index(const int i, const int j)
+{
+	return i >= j ? i * ( i + 1 ) / 2 + j : j * ( j + 1 ) / 2 + i;
 }
 
-void Position::init_evaluate()
+// Op`̔zuł̍s i ̐擪(i >= j  (i, j) ͂Aĕ)
+inline int kpp_row(const int i)
 {
-	int iret=0;
-	FILE *fp;
-	const char *fname ="]xNg";
-
-	do {
-		size_t size;
+	return i * ( i + 1 ) / 2;
+}
 
-		// KK
-		fname = FV_KK_BIN;
-		fp = fopen(fname, "rb");
-		if ( fp == NULL ) { iret = -2; break;}
+namespace {
+	// ]xNg. 3̃t@C܂Ƃ߂ϊς݂̃C[W(FV_IMG)}bvĎg.
+	// C[W̃CAEg͂̍\̂̂
+	struct Weights {
+		CACHE_LINE_ALIGNMENT short kpp[nsquare][pos_n];	// pos_n ͋Ȃ̂Ŋeʂ̕\4oCgEɂ
+		CACHE_LINE_ALIGNMENT int kkp[nsquare][nsquare][fe_end];
+		CACHE_LINE_ALIGNMENT int kk[nsquare][nsquare];
+	};
 
-		size = nsquare * nsquare;
-		if ( fread( fv_kk, sizeof(int), size, fp ) != size ) {
-			iret = -2;
-			break;
+	const short (*fv_kpp)[pos_n];
+	const int (*fv_kkp)[nsquare][fe_end];
+	const int (*fv_kk)[nsquare];
+
+	// ̃Xgԍ̏ɕבւ. Xgɓ2Ȃ̂ŁArbg
+	// ĂĂ珬Ɏo. Ȃ i > j ̑g (list[i], list[j]) ͎Op`
+	// s list[i] ̒ɂAkpp_index() ̑召rȂ1̍sO珇ɎQƂł
+	void sort_list(int list[], const int nlist)
+	{
+		uint32_t bits[(fe_end + 31) / 32] = { 0 };
+		for (int i = 0; i < nlist; i++) {
+			bits[list[i] >> 5] |= 1u << (list[i] & 31);
 		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
+		int n = 0;
+		for (int i = 0; i < (fe_end + 31) / 32; i++) {
+			unsigned long b = bits[i], id;
+			while (_BitScanForward(&id, b)) {
+				list[n++] = i * 32 + int(id);
+				b &= b - 1;
+			}
 		}
-		fclose(fp);
+		assert(n == nlist);
+	}
 
-		// KKP
-		fname = FV_KKP_BIN;
-		fp = fopen(fname, "rb");
-		if ( fp == NULL ) { iret = -2; break;}
+}
 
-		size = nsquare * nsquare * fe_end;
-		if ( fread( fv_kkp, sizeof(int), size, fp ) != size ) {
-			iret = -2;
-			break;
+// KPP ̘a߂J[l. init_evaluate()  CPU ɍ킹đI.
+//   kpp_triangle: list  i > j ƂȂgׂĂ KPP ̘a(ʕ)ƁApX KKP ̘a߂.
+//                 kppSortedList  true ̃J[ĺAlist0, list1 ꂼꏸɕł邱
+//   kpp_rows    : 1̓(ʗp kb ƌʗp kw) list ̊eƂ KPP ̘a߂
+// pkppb, pkppw ͐ʁAʂ̈ʒu̎Op` KPP ̕\.
+namespace {
+	struct KppSums {
+		int kkp, kppb, kppw;
+	};
+	typedef void (*KppTriangleFn)(const short* pkppb, const short* pkppw, const int* pkkp,
+	                              const int list0[], const int list1[], const int nlist, KppSums& s);
+	typedef void (*KppRowsFn)(const short* pkppb, const short* pkppw, const int kb, const int kw,
+	                          const int list0[], const int list1[], const int n, int& kppb, int& kppw);
+
+#if !defined(KPP_SSE2)
+	void kpp_triangle_scalar(const short* pkppb, const short* pkppw, const int* pkkp,
+	                         const int list0[], const int list1[], const int nlist, KppSums& s)
+	{
+		int kkp = 0, kppb = 0, kppw = 0;
+		for (int i = 0; i < nlist; i++) {
+			const short* rowb = pkppb + kpp_row(list0[i]);
+			const short* roww = pkppw + kpp_row(list1[i]);
+			for (int j = 0; j < i; j++) {
+				kppb += rowb[list0[j]];
+				kppw += roww[list1[j]];
+			}
+			kkp += pkkp[list0[i]];
 		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
+		s.kkp = kkp;
+		s.kppb = kppb;
+		s.kppw = kppw;
+	}
+
+	void kpp_rows_scalar(const short* pkppb, const short* pkppw, const int kb, const int kw,
+	                     const int list0[], const int list1[], const int n, int& kppb, int& kppw)
+	{
+		int b = 0, w = 0;
+		for (int i = 0; i < n; i++) {
+			b += pkppb[kpp_index(kb, list0[i])];
+			w += pkppw[kpp_index(kw, list1[i])];
 		}
-		fclose(fp);
+		kppb = b;
+		kppw = w;
+	}
+#endif
+
+#if defined(KPP_SSE2)
+	// SSE2 ɂ gather Ȃ̂8vfl߂āApmaddwd  32bit ɍLȂ瑫
+	inline __m128i load_row8(const short* row, const int l[])
+	{
+		return _mm_setr_epi16(row[l[0]], row[l[1]], row[l[2]], row[l[3]],
+		                      row[l[4]], row[l[5]], row[l[6]], row[l[7]]);
+	}
 
-		// KPP
-		fname = FV_KPP_BIN;
-		fp = fopen(fname, "rb");
-		if ( fp == NULL ) { iret = -2; break;}
+	inline __m128i load_kpp8(const short* pkpp, const int k, const int l[])
+	{
+		return _mm_setr_epi16(pkpp[kpp_index(k, l[0])], pkpp[kpp_index(k, l[1])],
+		                      pkpp[kpp_index(k, l[2])], pkpp[kpp_index(k, l[3])],
+		                      pkpp[kpp_index(k, l[4])], pkpp[kpp_index(k, l[5])],
+		                      pkpp[kpp_index(k, l[6])], pkpp[kpp_index(k, l[7])]);
+	}
 
-		size = nsquare * fe_end * fe_end;
-		if ( (iret=fread( fv_kpp, sizeof(short), size, fp )) != size ) {
-			fprintf(stderr, "%s:%d:iret = %d\n", __FILE__, __LINE__, iret);
-			iret = -2;
-			break;
+	inline int hsum_epi32(__m128i v)
+	{
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+		return _mm_cvtsi128_si32(v);
+	}
+
+	void kpp_triangle_sse2(const short* pkppb, const short* pkppw, const int* pkkp,
+	                       const int list0[], const int list1[], const int nlist, KppSums& s)
+	{
+		const __m128i ones = _mm_set1_epi16(1);
+		__m128i accb = _mm_setzero_si128();
+		__m128i accw = _mm_setzero_si128();
+		int kkp = 0, kppb = 0, kppw = 0;
+		for (int i = 0; i < nlist; i++) {
+			const short* rowb = pkppb + kpp_row(list0[i]);
+			const short* roww = pkppw + kpp_row(list1[i]);
+			int j = 0;
+			for (; j + 8 <= i; j += 8) {
+				accb = _mm_add_epi32(accb, _mm_madd_epi16(load_row8(rowb, list0 + j), ones));
+				accw = _mm_add_epi32(accw, _mm_madd_epi16(load_row8(roww, list1 + j), ones));
+			}
+			for (; j < i; j++) {
+				kppb += rowb[list0[j]];
+				kppw += roww[list1[j]];
+			}
+			kkp += pkkp[list0[i]];
 		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
+		s.kkp = kkp;
+		s.kppb = kppb + hsum_epi32(accb);
+		s.kppw = kppw + hsum_epi32(accw);
+	}
+
+	void kpp_rows_sse2(const short* pkppb, const short* pkppw, const int kb, const int kw,
+	                   const int list0[], const int list1[], const int n, int& kppb, int& kppw)
+	{
+		const __m128i ones = _mm_set1_epi16(1);
+		__m128i accb = _mm_setzero_si128();
+		__m128i accw = _mm_setzero_si128();
+		int b = 0, w = 0;
+		int i = 0;
+		for (; i + 8 <= n; i += 8) {
+			accb = _mm_add_epi32(accb, _mm_madd_epi16(load_kpp8(pkppb, kb, list0 + i), ones));
+			accw = _mm_add_epi32(accw, _mm_madd_epi16(load_kpp8(pkppw, kw, list1 + i), ones));
 		}
-		fclose(fp);
-	} while (0);
+		for (; i < n; i++) {
+			b += pkppb[kpp_index(kb, list0[i])];
+			w += pkppw[kpp_index(kw, list1[i])];
+		}
+		kppb = b + hsum_epi32(accb);
+		kppw = w + hsum_epi32(accw);
+	}
+#endif
 
-	if (iret < 0) {
-		std::cerr << "Can't load " << fname << "." << std::endl;
-#if defined(CSADLL) || defined(CSA_DIRECT)
-		::MessageBox(NULL, "]xNg[hł܂\nI܂", "Error!", MB_OK);
-#endif	// defined(CSA_DLL) || defined(CSA_DIRECT)
-		exit(1);
+#if defined(KPP_AVX2)
+	//  k 8̓ l ̑ǵAOp`̔zuł̃CfbNX(kpp_index() 8)
+	TARGET_AVX2 inline __m256i kpp_index8(const __m256i k, const __m256i l)
+	{
+		const __m256i hi = _mm256_max_epi32(k, l);
+		const __m256i lo = _mm256_min_epi32(k, l);
+		return _mm256_add_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(hi, _mm256_add_epi32(hi, _mm256_set1_epi32(1))), 1), lo);
 	}
 
-	int i;
-	for ( i = 0; i < 31; i++) { p_value[i]       = 0; }
-
-	p_value[15+pawn]       = DPawn;
-	p_value[15+lance]      = DLance;
-	p_value[15+knight]     = DKnight;
-	p_value[15+silver]     = DSilver;
-	p_value[15+gold]       = DGold;
-	p_value[15+bishop]     = DBishop;
-	p_value[15+rook]       = DRook;
-	p_value[15+king]       = DKing;
-	p_value[15+pro_pawn]   = DProPawn;
-	p_value[15+pro_lance]  = DProLance;
-	p_value[15+pro_knight] = DProKnight;
-	p_value[15+pro_silver] = DProSilver;
-	p_value[15+horse]      = DHorse;
-	p_value[15+dragon]     = DDragon;
-
-	p_value[15-pawn]          = p_value[15+pawn];
-	p_value[15-lance]         = p_value[15+lance];
-	p_value[15-knight]        = p_value[15+knight];
-	p_value[15-silver]        = p_value[15+silver];
-	p_value[15-gold]          = p_value[15+gold];
-	p_value[15-bishop]        = p_value[15+bishop];
-	p_value[15-rook]          = p_value[15+rook];
-	p_value[15-king]          = p_value[15+king];
-	p_value[15-pro_pawn]      = p_value[15+pro_pawn];
-	p_value[15-pro_lance]     = p_value[15+pro_lance];
-	p_value[15-pro_knight]    = p_value[15+pro_knight];
-	p_value[15-pro_silver]    = p_value[15+pro_silver];
-	p_value[15-horse]         = p_value[15+horse];
-	p_value[15-dragon]        = p_value[15+dragon];
-}
+	// pkpp[idx] (short) 8W߂ 32bit ɕg. short 𒼐 gather łȂ̂ŁA
+	//  short ܂4oCgE int ǂŁAʂʂ16bito
+	// (E܂Ȃ̂Ŕz̊OǂނƂ͂Ȃ).
+	TARGET_AVX2 inline __m256i gather_kpp8(const short* pkpp, const __m256i k, const int l[])
+	{
+		const __m256i idx = kpp_index8(k, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l)));
+		const __m256i g = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pkpp), _mm256_srli_epi32(idx, 1), 4);
+		const __m256i sh = _mm256_slli_epi32(_mm256_andnot_si256(idx, _mm256_set1_epi32(1)), 4);
+		return _mm256_srai_epi32(_mm256_sllv_epi32(g, sh), 16);
+	}
 
-int Position::compute_material() const
-{
-	int v, item, itemp;
-	int i;
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_FU; i <= KNE_FU; i++) {
-		if (knkind[i] == SFU) item++;
-		if (knkind[i] == GFU) item--;
-		if (knkind[i] == STO) itemp++;
-		if (knkind[i] == GTO) itemp--;
+	// 擪 n vf(n < 8)W߂. c̃[ 0
+	TARGET_AVX2 inline __m256i tail_mask(const int n)
+	{
+		return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
 	}
-	v  = item  * p_value[15+pawn];
-	v += itemp * p_value[15+pro_pawn];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KY; i <= KNE_KY; i++) {
-		if (knkind[i] == SKY) item++;
-		if (knkind[i] == GKY) item--;
-		if (knkind[i] == SNY) itemp++;
-		if (knkind[i] == GNY) itemp--;
+
+	TARGET_AVX2 inline __m256i gather_kpp8_tail(const short* pkpp, const __m256i k, const int l[], const __m256i mask)
+	{
+		const __m256i idx = kpp_index8(k, _mm256_maskload_epi32(l, mask));
+		const __m256i g = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(pkpp),
+		                                              _mm256_srli_epi32(idx, 1), mask, 4);
+		const __m256i sh = _mm256_slli_epi32(_mm256_andnot_si256(idx, _mm256_set1_epi32(1)), 4);
+		return _mm256_srai_epi32(_mm256_sllv_epi32(g, sh), 16);
 	}
-	v += item  * p_value[15+lance];
-	v += itemp * p_value[15+pro_lance];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KE; i <= KNE_KE; i++) {
-		if (knkind[i] == SKE) item++;
-		if (knkind[i] == GKE) item--;
-		if (knkind[i] == SNK) itemp++;
-		if (knkind[i] == GNK) itemp--;
+
+	TARGET_AVX2 inline int hsum_epi32_avx2(const __m256i v)
+	{
+		__m128i x = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4e));
+		x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0xb1));
+		return _mm_cvtsi128_si32(x);
 	}
-	v += item  * p_value[15+knight];
-	v += itemp * p_value[15+pro_knight];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_GI; i <= KNE_GI; i++) {
-		if (knkind[i] == SGI) item++;
-		if (knkind[i] == GGI) item--;
-		if (knkind[i] == SNG) itemp++;
-		if (knkind[i] == GNG) itemp--;
+
+	TARGET_AVX2 void kpp_triangle_avx2(const short* pkppb, const short* pkppw, const int* pkkp,
+	                                   const int list0[], const int list1[], const int nlist, KppSums& s)
+	{
+		__m256i acck = _mm256_setzero_si256();
+		__m256i accb = _mm256_setzero_si256();
+		__m256i accw = _mm256_setzero_si256();
+		for (int i = 0; i < nlist; i++) {
+			const __m256i kb = _mm256_set1_epi32(list0[i]);
+			const __m256i kw = _mm256_set1_epi32(list1[i]);
+			int j = 0;
+			for (; j + 8 <= i; j += 8) {
+				accb = _mm256_add_epi32(accb, gather_kpp8(pkppb, kb, list0 + j));
+				accw = _mm256_add_epi32(accw, gather_kpp8(pkppw, kw, list1 + j));
+			}
+			if (j < i) {
+				const __m256i mask = tail_mask(i - j);
+				accb = _mm256_add_epi32(accb, gather_kpp8_tail(pkppb, kb, list0 + j, mask));
+				accw = _mm256_add_epi32(accw, gather_kpp8_tail(pkppw, kw, list1 + j, mask));
+			}
+			// KKP 8sƂɁA8̓̕܂Ƃ߂ďW߂
+			if ((i & 7) == 0) {
+				const __m256i mask = tail_mask(nlist - i);
+				const __m256i idx = _mm256_maskload_epi32(list0 + i, mask);
+				acck = _mm256_add_epi32(acck, _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), pkkp, idx, mask, 4));
+			}
+		}
+		s.kkp = hsum_epi32_avx2(acck);
+		s.kppb = hsum_epi32_avx2(accb);
+		s.kppw = hsum_epi32_avx2(accw);
 	}
-	v += item  * p_value[15+silver];
-	v += itemp * p_value[15+pro_silver];
 
-	item  = 0;
-	for (i = KNS_KI; i <= KNE_KI; i++) {
-		if (knkind[i] == SKI) item++;
-		if (knkind[i] == GKI) item--;
+	TARGET_AVX2 void kpp_rows_avx2(const short* pkppb, const short* pkppw, const int kb, const int kw,
+	                               const int list0[], const int list1[], const int n, int& kppb, int& kppw)
+	{
+		const __m256i vkb = _mm256_set1_epi32(kb);
+		const __m256i vkw = _mm256_set1_epi32(kw);
+		__m256i accb = _mm256_setzero_si256();
+		__m256i accw = _mm256_setzero_si256();
+		int i = 0;
+		for (; i + 8 <= n; i += 8) {
+			accb = _mm256_add_epi32(accb, gather_kpp8(pkppb, vkb, list0 + i));
+			accw = _mm256_add_epi32(accw, gather_kpp8(pkppw, vkw, list1 + i));
+		}
+		if (i < n) {
+			const __m256i mask = tail_mask(n - i);
+			accb = _mm256_add_epi32(accb, gather_kpp8_tail(pkppb, vkb, list0 + i, mask));
+			accw = _mm256_add_epi32(accw, gather_kpp8_tail(pkppw, vkw, list1 + i, mask));
+		}
+		kppb = hsum_epi32_avx2(accb);
+		kppw = hsum_epi32_avx2(accw);
 	}
-	v += item  * p_value[15+gold];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_KA; i <= KNE_KA; i++) {
-		if (knkind[i] == SKA) item++;
-		if (knkind[i] == GKA) item--;
-		if (knkind[i] == SUM) itemp++;
-		if (knkind[i] == GUM) itemp--;
+#endif
+
+#if defined(KPP_SSE2)
+	KppTriangleFn kpp_triangle = kpp_triangle_sse2;
+	KppRowsFn kpp_rows = kpp_rows_sse2;
+#else
+	KppTriangleFn kpp_triangle = kpp_triangle_scalar;
+	KppRowsFn kpp_rows = kpp_rows_scalar;
+#endif
+	// XgבւĂ kpp_triangle Ă. AVX2 ̃J[l kpp_index8() ̑召r
+	// RŁAבւ̎Ԃ̂ق̂ŕבւȂ
+	bool kppSortedList = true;
+}
+
+namespace {
+	const char *fname ="]xNg";
+
+	// 3̃t@Cǂŕ]xNggݗĂ. C[WȂÂƂĂ΂
+	bool read_weights(void* data)
+	{
+		Weights& w = *static_cast<Weights*>(data);
+		int iret=0;
+		FILE *fp;
+
+		do {
+			size_t size;
+
+			// KK
+			fname = FV_KK_BIN;
+			fp = fopen(fname, "rb");
+			if ( fp == NULL ) { iret = -2; break;}
+
+			size = nsquare * nsquare;
+			if ( fread( w.kk, sizeof(int), size, fp ) != size ) {
+				iret = -2;
+				break;
+			}
+			if (fgetc(fp) != EOF) {
+				iret = -2;
+				break;
+			}
+			fclose(fp);
+
+			// KKP
+			fname = FV_KKP_BIN;
+			fp = fopen(fname, "rb");
+			if ( fp == NULL ) { iret = -2; break;}
+
+			size = nsquare * nsquare * fe_end;
+			if ( fread( w.kkp, sizeof(int), size, fp ) != size ) {
+				iret = -2;
+				break;
+			}
+			if (fgetc(fp) != EOF) {
+				iret = -2;
+				break;
+			}
+			fclose(fp);
+
+			// KPP. ʂ̈ʒuƂɓǂŁAi >= j ̕Op`̔zuɋl߂
+			fname = FV_KPP_BIN;
+			fp = fopen(fname, "rb");
+			if ( fp == NULL ) { iret = -2; break;}
+
+			size = fe_end * fe_end;
+			short (*kpp)[fe_end] = (short (*)[fe_end])malloc(sizeof(short)*size);
+			if (kpp == NULL) { iret = -2; break;}
+			for (int k = 0; k < nsquare && iret >= 0; k++) {
+				if ( fread( kpp, sizeof(short), size, fp ) != size ) {
+					fprintf(stderr, "%s:%d:k = %d\n", __FILE__, __LINE__, k);
+					iret = -2;
+					break;
+				}
+				for (int i = 0; i < fe_end; i++) {
+					for (int j = 0; j <= i; j++) {
+						w.kpp[k][kpp_index(i, j)] = kpp[i][j];
+					}
+				}
+			}
+			free(kpp);
+			if (iret < 0) break;
+			if (fgetc(fp) != EOF) {
+				iret = -2;
+				break;
+			}
+			fclose(fp);
+		} while (0);
+
+		return iret >= 0;
+	}
+}
+
+template<>
+void Position::init_evaluate<EVALTYPE_APERY>()
+{
+	const char* const sources[] = { FV_KK_BIN, FV_KKP_BIN, FV_KPP_BIN };
+	const Weights* w = static_cast<const Weights*>(
+		EvalImage::load(FV_IMG, FV_TAG, sources, 3, sizeof(Weights), read_weights));
+
+	if (w) {
+		fv_kpp = w->kpp;
+		fv_kkp = w->kkp;
+		fv_kk = w->kk;
+	} else {
+		std::cerr << "Can't load " << fname << "." << std::endl;
+#if defined(CSADLL) || defined(CSA_DIRECT)
+		::MessageBox(NULL, "]xNg[hł܂\nI܂", "Error!", MB_OK);
+#endif	// defined(CSA_DLL) || defined(CSA_DIRECT)
+		exit(1);
 	}
-	v += item  * p_value[15+bishop];
-	v += itemp * p_value[15+horse];
-
-	item  = 0;
-	itemp = 0;
-	for (i = KNS_HI; i <= KNE_HI; i++) {
-		if (knkind[i] == SHI) item++;
-		if (knkind[i] == GHI) item--;
-		if (knkind[i] == SRY) itemp++;
-		if (knkind[i] == GRY) itemp--;
+
+#if defined(KPP_AVX2)
+	if (CpuHasAVX2) {
+		kpp_triangle = kpp_triangle_avx2;
+		kpp_rows = kpp_rows_avx2;
+		kppSortedList = false;
 	}
-	v += item  * p_value[15+rook];
-	v += itemp * p_value[15+dragon];
+#endif
+}
 
+template<>
+const int* Position::piece_values<EVALTYPE_APERY>()
+{
+	static const int v[16] = {
+		0, DPawn, DLance, DKnight, DSilver, DGold, DBishop, DRook,
+		DKing, DProPawn, DProLance, DProKnight, DProSilver, 0, DHorse, DDragon,
+	};
 	return v;
 }
 
 int Position::make_list_apery(int list0[NLIST], int list1[NLIST], int nlist) const
 {
-	static const struct {
-		int f_pt, e_pt;
-	} base_tbl[] = {
-		{-1      , -1      },	//  0:---
-		{f_pawn  , e_pawn  },	//  1:SFU
-		{f_lance , e_lance },	//  2:SKY
-		{f_knight, e_knight},	//  3:SKE
-		{f_silver, e_silver},	//  4:SGI
-		{f_gold  , e_gold  },	//  5:SKI
-		{f_bishop, e_bishop},	//  6:SKA
-		{f_rook  , e_rook  },	//  7:SHI
-		{-1      , -1      },	//  8:SOU
-		{f_gold  , e_gold  },	//  9:STO
-		{f_gold  , e_gold  },	// 10:SNY
-		{f_gold  , e_gold  },	// 11:SNK
-		{f_gold  , e_gold  },	// 12:SNG
-		{-1      , -1      },	// 13:--
-		{f_horse , e_horse },	// 14:SUM
-		{f_dragon, e_dragon},	// 15:SRY
-		{-1      , -1      },	// 16:---
-		{e_pawn  , f_pawn  },	// 17:GFU
-		{e_lance , f_lance },	// 18:GKY
-		{e_knight, f_knight},	// 19:GKE
-		{e_silver, f_silver},	// 20:GGI
-		{e_gold  , f_gold  },	// 21:GKI
-		{e_bishop, f_bishop},	// 22:GKA
-		{e_rook  , f_rook  },	// 23:GHI
-		{-1      , -1      },	// 24:GOU
-		{e_gold  , f_gold  },	// 25:GTO
-		{e_gold  , f_gold  },	// 26:GNY
-		{e_gold  , f_gold  },	// 27:GNK
-		{e_gold  , f_gold  },	// 28:GNG
-		{-1      , -1      },	// 29:---
-		{e_horse , f_horse },	// 30:GUM
-		{e_dragon, f_dragon}	// 31:GRY
-	};
 	int sq;
 
 	// ԍF1`2ʁA3`40ʈȊO
@@ -367,7 +471,7 @@ int Position::make_list_apery(int list0[NLIST], int list1[NLIST], int nlist) con
 		const int z = knpos[kn];
 		if (z < 0x11) continue;			// 
 		int piece = knkind[kn];
-		sq = conv_z2sq(z);
+		sq = z2sq[z];
 		assert(piece <= GRY && sq < nsquare);
 		assert(base_tbl[piece].f_pt != -1);
 		list0[nlist] = base_tbl[piece].f_pt + sq;
@@ -380,66 +484,179 @@ int Position::make_list_apery(int list0[NLIST], int list1[NLIST], int nlist) con
 	return nlist;
 }
 
-int Position::evaluate(const Color us) const
+/// Position::compute_eval_sums()  KK+KKP Ɨʂ KPP ̘aꂩvZ.
+
+template<>
+void Position::compute_eval_sums<EVALTYPE_APERY>(int evalSum[3]) const
 {
 	int list0[NLIST], list1[NLIST];
-	int score, sq_bk, sq_wk;
-	static int count=0;
-	count++;
-	int nlist=0;
-
-	// Xg
-#define FOO(hand, Piece, list0_index, list1_index)    \
-	for (int i = I2Hand##Piece(hand); i >= 1; --i) {  \
-		list0[nlist] = list0_index + i;               \
-		list1[nlist] = list1_index + i;               \
-		++nlist; \
-	}
-
-	FOO(HAND_B, Pawn  , f_hand_pawn  , e_hand_pawn  )
-	FOO(HAND_W, Pawn  , e_hand_pawn  , f_hand_pawn  )
-	FOO(HAND_B, Lance , f_hand_lance , e_hand_lance )
-	FOO(HAND_W, Lance , e_hand_lance , f_hand_lance )
-	FOO(HAND_B, Knight, f_hand_knight, e_hand_knight)
-	FOO(HAND_W, Knight, e_hand_knight, f_hand_knight)
-	FOO(HAND_B, Silver, f_hand_silver, e_hand_silver)
-	FOO(HAND_W, Silver, e_hand_silver, f_hand_silver)
-	FOO(HAND_B, Gold  , f_hand_gold  , e_hand_gold  )
-	FOO(HAND_W, Gold  , e_hand_gold  , f_hand_gold  )
-	FOO(HAND_B, Bishop, f_hand_bishop, e_hand_bishop)
-	FOO(HAND_W, Bishop, e_hand_bishop, f_hand_bishop)
-	FOO(HAND_B, Rook  , f_hand_rook  , e_hand_rook  )
-	FOO(HAND_W, Rook  , e_hand_rook  , f_hand_rook  )
-#undef FOO
+	int nlist, sq_bk, sq_wk;
 
+	nlist = make_list_hand(HAND_B, HAND_W, list0, list1);
 	nlist = make_list_apery(list0, list1, nlist);
 
+	// ʑ(list0 m)ƌʑ(list1 m) KPP ͕ʁXɋ߂̂ŁAʁXɕׂĂ悢
+	if (kppSortedList) {
+		sort_list(list0, nlist);
+		sort_list(list1, nlist);
+	}
+
 	sq_bk = SQ_BKING;
 	sq_wk = SQ_WKING;
 	assert(0 <= sq_bk && sq_bk < nsquare);
 	assert(0 <= sq_wk && sq_wk < nsquare);
-	const auto* ppkppb = fv_kpp[sq_bk     ];
-	const auto* ppkppw = fv_kpp[Inv(sq_wk)];
-
-	score = fv_kk[sq_bk][sq_wk];
-	for (int i = 0; i < nlist; i++ ) {
-		const int k0 = list0[i];
-		const int k1 = list1[i];
-		assert(0 <= k0 && k0 < fe_end);
-		assert(0 <= k1 && k1 < fe_end);
-		const auto* pkppb = ppkppb[k0];
-		const auto* pkppw = ppkppw[k1];
-		for (int j = 0; j < i; j++ ) {
-			const int l0 = list0[j];
-			const int l1 = list1[j];
-			assert(0 <= l0 && l0 < fe_end);
-			assert(0 <= l1 && l1 < fe_end);
-			score += pkppb[l0];
-			score -= pkppw[l1];
+	const short* pkppb = fv_kpp[sq_bk     ];
+	const short* pkppw = fv_kpp[Inv(sq_wk)];
+
+#if !defined(NDEBUG)
+	for (int i = 0; i < nlist; i++) {
+		assert(0 <= list0[i] && list0[i] < fe_end);
+		assert(0 <= list1[i] && list1[i] < fe_end);
+	}
+#endif
+
+	KppSums s;
+	kpp_triangle(pkppb, pkppw, fv_kkp[sq_bk][sq_wk], list0, list1, nlist, s);
+
+	evalSum[1] = s.kppb;
+	evalSum[2] = s.kppw;
+	evalSum[0] = fv_kk[sq_bk][sq_wk] + s.kkp;
+}
+
+/// Position::eval_stage()  compute_eval_sums() ̊e1s(bench eval p).
+/// SUMS ̓Xg̕בւ܂. בւ͉xsĂȂ̂ŁASUMS JԂ.
+
+template<>
+int Position::eval_stage<EVALTYPE_APERY>(EvalStage stage, EvalScratch& w) const
+{
+	switch (stage) {
+	case EVAL_STAGE_HAND:
+		w.nhand = make_list_hand(HAND_B, HAND_W, w.list0, w.list1);
+		return w.nhand;
+	case EVAL_STAGE_LIST:
+		w.nlist = make_list_apery(w.list0, w.list1, w.nhand);
+		return w.nlist;
+	case EVAL_STAGE_SUMS: {
+		if (kppSortedList) {
+			sort_list(w.list0, w.nlist);
+			sort_list(w.list1, w.nlist);
 		}
-		score += fv_kkp[sq_bk][sq_wk][k0];
+		const int sq_bk = SQ_BKING;
+		const int sq_wk = SQ_WKING;
+		KppSums s;
+		kpp_triangle(fv_kpp[sq_bk], fv_kpp[Inv(sq_wk)], fv_kkp[sq_bk][sq_wk], w.list0, w.list1, w.nlist, s);
+		return fv_kk[sq_bk][sq_wk] + s.kkp + s.kppb - s.kppw;
+	}
+	case EVAL_STAGE_MATERIAL:		// ]֐ɂȂ. Position::eval_stage() s
+	case EVAL_STAGE_NB:
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+/// Position::update_eval_sums()  StateInfo  KK+KKP  KPP ̘a߂.
+/// aĂǖʂ܂ StateInfo kÅԂɕω(A
+/// Ał)W߂āA̓Ǝc̓Ƃ̑g̕𑫂
+/// (fv_kpp ͑Ώ̂łO). kr̋ǖʂ̖̎́A̎tZ.
+/// rŋʂƂAωƂAkȂȂƂ͈ꂩ
+/// vZ. lݒT evaluate() Ă΂Ȃǖʂ̕܂ŌvZȂ悤Ado_move()
+/// ł͌vZɂŒxċ߂.
+
+template<>
+void Position::update_eval_sums<EVALTYPE_APERY>() const
+{
+	FeatureDiff diff;
+	diff.nrem = diff.nadd = 0;
+	uint32_t h[2] = { HAND_B, HAND_W };		// kĂǖ(s)̎
+	const StateInfo* s = st;
+
+	for (;;) {
+		const Move m = s->lastMove;
+		if (s->previous == NULL || m == MOVE_NONE
+		 || move_piece(m) == SOU || move_piece(m) == GOU
+		 || diff.nrem > MaxDiffFeatures - 2 || diff.nadd > MaxDiffFeatures - 2) {
+			compute_eval_sums<EVALTYPE_APERY>(st->evalSum);
+			return;
+		}
+
+		diff.add_move(s, h);
+
+		s = s->previous;
+		if (s->evalSum[0] != EVAL_SUM_NONE)
+			break;
+	}
+
+	assert(diff.nrem == diff.nadd);
+
+	// ωĂȂ̃Xg
+	int list0[NLIST], list1[NLIST];
+	int nlist = make_list_hand(HAND_B, HAND_W, list0, list1);
+	nlist = make_list_apery(list0, list1, nlist);
+	int n = 0;
+	for (int i = 0; i < nlist; i++) {
+		if (diff.is_added(list0[i])) continue;	// m͌ő
+		list0[n] = list0[i];
+		list1[n] = list1[i];
+		n++;
 	}
 
+	const int sq_bk = SQ_BKING;
+	const int sq_wk = SQ_WKING;
+	const short* pkppb = fv_kpp[sq_bk     ];
+	const short* pkppw = fv_kpp[Inv(sq_wk)];
+	const int* pkkp = fv_kkp[sq_bk][sq_wk];
+
+	int kkp = 0;
+	int kppb = 0;
+	int kppw = 0;
+	int b, w;
+	for (int j = 0; j < diff.nadd; j++) {
+		kpp_rows(pkppb, pkppw, diff.add0[j], diff.add1[j], list0, list1, n, b, w);
+		kppb += b;
+		kppw += w;
+	}
+	for (int j = 0; j < diff.nrem; j++) {
+		kpp_rows(pkppb, pkppw, diff.rem0[j], diff.rem1[j], list0, list1, n, b, w);
+		kppb -= b;
+		kppw -= w;
+	}
+	for (int i = 0; i < diff.nadd; i++) {
+		kkp += pkkp[diff.add0[i]];
+		for (int j = 0; j < i; j++) {
+			kppb += pkppb[kpp_index(diff.add0[i], diff.add0[j])];
+			kppw += pkppw[kpp_index(diff.add1[i], diff.add1[j])];
+		}
+	}
+	for (int i = 0; i < diff.nrem; i++) {
+		kkp -= pkkp[diff.rem0[i]];
+		for (int j = 0; j < i; j++) {
+			kppb -= pkppb[kpp_index(diff.rem0[i], diff.rem0[j])];
+			kppw -= pkppw[kpp_index(diff.rem1[i], diff.rem1[j])];
+		}
+	}
+
+	// ̃XbhǖʂQƂ邱Ƃ̂ŁAvZ͍̈Ōɏ
+	st->evalSum[1] = s->evalSum[1] + kppb;
+	st->evalSum[2] = s->evalSum[2] + kppw;
+	st->evalSum[0] = s->evalSum[0] + kkp;
+}
+
+template<>
+int Position::evaluate<EVALTYPE_APERY>(const Color us) const
+{
+	int score;
+
+	if (st->evalSum[0] == EVAL_SUM_NONE)
+		update_eval_sums<EVALTYPE_APERY>();
+
+#if !defined(NDEBUG)
+	int evalSum[3];
+	compute_eval_sums<EVALTYPE_APERY>(evalSum);
+	assert(evalSum[0] == st->evalSum[0] && evalSum[1] == st->evalSum[1] && evalSum[2] == st->evalSum[2]);
+#endif
+
+	score = st->evalSum[0] + st->evalSum[1] - st->evalSum[2];
 	score += MATERIAL * FV_SCALE;
 	score /= FV_SCALE;
 
@@ -447,10 +664,3 @@ int Position::evaluate(const Color us) const
 
 	return score;
 }
-
-Value evaluate(const Position& pos, Value& margin)
-{
-	margin = VALUE_ZERO;
-	const Color us = pos.side_to_move();
-	return Value(pos.evaluate(us));
-}
@@ -0,0 +1,528 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "position.h"
+#include "evaluate.h"
+#include "evalimage.h"
+#include "evalfeature.h"
+
+// SIMD kernels of the network. The AVX2 ones are chosen at run time.
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define NNUE_AVX2
+#if defined(__SSE2__) || defined(_M_X64)
+#define NNUE_SSE2
+#endif
+#endif
+
+// The network is the "halfkp_256x2-32-32" one of YaneuraOu, read from its
+// nn.bin file:
+//   HalfKP(Friend)[125388->256x2] -> ClippedReLU -> Affine[512->32] -> ClippedReLU
+//   -> Affine[32->32] -> ClippedReLU -> Affine[32->1]
+// A HalfKP feature is a piece other than a king (an EvalFeature) together
+// with the square of the king of the perspective, which is turned around for
+// the second player like the pieces of list1.
+#define NN_BIN "nn.bin"
+#define NN_IMG "nn.img"
+#define NN_TAG "nnue-halfkp256"
+
+#define HAND_B              (this->hand[BLACK].h)
+#define HAND_W              (this->hand[WHITE].h)
+
+using namespace EvalFeature;
+
+namespace {
+
+	const int HalfDims = NNUE_HALF_DIMENSIONS;
+	const int InputDims = nsquare * fe_end;
+	const int L1 = 32;
+	const int L2 = 32;
+	const int MaxActive = 38;			// pieces other than the kings
+
+	const int WeightScaleBits = 6;
+	const int FV_SCALE = 16;
+
+	// The file header: the version, and hashes of the architecture that
+	// YaneuraOu computes from the layers, checked to refuse other networks.
+	const uint32_t Version = 0x7AF32F16u;
+
+	const uint32_t TransformerHash = (0x5D69D5B9u ^ 1) ^ uint32_t(2 * HalfDims);
+
+	uint32_t affine_hash(const uint32_t prev, const uint32_t outDims)
+	{
+		uint32_t h = 0xCC03DAE4u + outDims;
+		h ^= prev >> 1;
+		h ^= prev << 31;
+		return h;
+	}
+
+	uint32_t relu_hash(const uint32_t prev)
+	{
+		return 0x538D24C7u + prev;
+	}
+
+	uint32_t network_hash()
+	{
+		const uint32_t input = 0xEC42E90Du ^ uint32_t(2 * HalfDims);
+		return affine_hash(relu_hash(affine_hash(relu_hash(affine_hash(input, L1)), L2)), 1);
+	}
+
+	// The weights, laid out as in the image (NN_IMG) that is mapped at startup
+	struct Weights {
+		CACHE_LINE_ALIGNMENT int16_t ftBiases[HalfDims];
+		CACHE_LINE_ALIGNMENT int16_t ftWeights[InputDims][HalfDims];
+		CACHE_LINE_ALIGNMENT int32_t b1[L1];
+		CACHE_LINE_ALIGNMENT int8_t w1[L1][2 * HalfDims];
+		CACHE_LINE_ALIGNMENT int32_t b2[L2];
+		CACHE_LINE_ALIGNMENT int8_t w2[L2][L1];
+		CACHE_LINE_ALIGNMENT int32_t b3[1];
+		CACHE_LINE_ALIGNMENT int8_t w3[1][L2];
+	};
+
+	const Weights* nn;
+
+	bool read_u32(FILE* fp, uint32_t& v)
+	{
+		return fread(&v, sizeof(v), 1, fp) == 1;
+	}
+
+	template<typename T>
+	bool read_array(FILE* fp, T* p, const size_t n)
+	{
+		return fread(p, sizeof(T), n, fp) == n;
+	}
+
+	bool read_network(FILE* fp, Weights& w)
+	{
+		uint32_t version, hash, size;
+
+		if (!read_u32(fp, version) || version != Version
+		 || !read_u32(fp, hash) || hash != (TransformerHash ^ network_hash())
+		 || !read_u32(fp, size) || fseek(fp, long(size), SEEK_CUR) != 0)	// architecture string
+			return false;
+
+		if (!read_u32(fp, hash) || hash != TransformerHash
+		 || !read_array(fp, w.ftBiases, HalfDims)
+		 || !read_array(fp, w.ftWeights[0], size_t(InputDims) * HalfDims))
+			return false;
+
+		if (!read_u32(fp, hash) || hash != network_hash()
+		 || !read_array(fp, w.b1, L1) || !read_array(fp, w.w1[0], size_t(L1) * 2 * HalfDims)
+		 || !read_array(fp, w.b2, L2) || !read_array(fp, w.w2[0], size_t(L2) * L1)
+		 || !read_array(fp, w.b3, 1)  || !read_array(fp, w.w3[0], size_t(L2)))
+			return false;
+
+		return fgetc(fp) == EOF;
+	}
+
+	// read_weights() reads nn.bin. Only called when the image is missing or stale.
+	bool read_weights(void* data)
+	{
+		FILE* fp = fopen(NN_BIN, "rb");
+		if (fp == NULL)
+			return false;
+
+		const bool ok = read_network(fp, *static_cast<Weights*>(data));
+		fclose(fp);
+		return ok;
+	}
+}
+
+// The kernels of the network, chosen by init_evaluate() for the CPU.
+//   accumulate: acc = base + the rows 'add' - the rows 'rem' of the feature transformer
+//   transform : clips an accumulator to 0..127, the input of the first layer
+//   affine    : out = b + w * in, the uint8 inputs are a multiple of 32
+namespace {
+	typedef void (*AccumulateFn)(int16_t acc[], const int16_t base[], const int add[], const int nadd,
+	                             const int rem[], const int nrem);
+	typedef void (*TransformFn)(const int16_t acc[], uint8_t out[]);
+	typedef void (*AffineFn)(const uint8_t in[], const int inDims, const int8_t* w, const int32_t b[],
+	                         const int outDims, int32_t out[]);
+
+	void clipped_relu(const int32_t in[], const int n, uint8_t out[])
+	{
+		for (int i = 0; i < n; i++) {
+			const int v = in[i] >> WeightScaleBits;
+			out[i] = uint8_t(v < 0 ? 0 : v > 127 ? 127 : v);
+		}
+	}
+
+#if !defined(NNUE_SSE2)
+	void accumulate_scalar(int16_t acc[], const int16_t base[], const int add[], const int nadd,
+	                       const int rem[], const int nrem)
+	{
+		if (acc != base)
+			memcpy(acc, base, sizeof(int16_t) * HalfDims);
+		for (int i = 0; i < nadd; i++) {
+			const int16_t* row = nn->ftWeights[add[i]];
+			for (int j = 0; j < HalfDims; j++)
+				acc[j] += row[j];
+		}
+		for (int i = 0; i < nrem; i++) {
+			const int16_t* row = nn->ftWeights[rem[i]];
+			for (int j = 0; j < HalfDims; j++)
+				acc[j] -= row[j];
+		}
+	}
+
+	void transform_scalar(const int16_t acc[], uint8_t out[])
+	{
+		for (int j = 0; j < HalfDims; j++)
+			out[j] = uint8_t(acc[j] < 0 ? 0 : acc[j] > 127 ? 127 : acc[j]);
+	}
+
+	void affine_scalar(const uint8_t in[], const int inDims, const int8_t* w, const int32_t b[],
+	                   const int outDims, int32_t out[])
+	{
+		for (int i = 0; i < outDims; i++) {
+			const int8_t* row = w + i * inDims;
+			int32_t sum = b[i];
+			for (int j = 0; j < inDims; j++)
+				sum += row[j] * in[j];
+			out[i] = sum;
+		}
+	}
+#endif
+
+#if defined(NNUE_SSE2)
+	// A row of 256 int16 is 32 registers, it is done in two halves of 16
+	void accumulate_sse2(int16_t acc[], const int16_t base[], const int add[], const int nadd,
+	                     const int rem[], const int nrem)
+	{
+		const int Regs = 16;
+		for (int h = 0; h < HalfDims; h += Regs * 8) {
+			__m128i r[Regs];
+			for (int k = 0; k < Regs; k++)
+				r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + h) + k);
+			for (int i = 0; i < nadd; i++) {
+				const __m128i* row = reinterpret_cast<const __m128i*>(nn->ftWeights[add[i]] + h);
+				for (int k = 0; k < Regs; k++)
+					r[k] = _mm_add_epi16(r[k], _mm_load_si128(row + k));
+			}
+			for (int i = 0; i < nrem; i++) {
+				const __m128i* row = reinterpret_cast<const __m128i*>(nn->ftWeights[rem[i]] + h);
+				for (int k = 0; k < Regs; k++)
+					r[k] = _mm_sub_epi16(r[k], _mm_load_si128(row + k));
+			}
+			for (int k = 0; k < Regs; k++)
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + h) + k, r[k]);
+		}
+	}
+
+	void transform_sse2(const int16_t acc[], uint8_t out[])
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (int j = 0; j < HalfDims; j += 16) {
+			const __m128i a = _mm_max_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + j)), zero);
+			const __m128i b = _mm_max_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + j + 8)), zero);
+			_mm_store_si128(reinterpret_cast<__m128i*>(out + j), _mm_packs_epi16(a, b));
+		}
+	}
+
+	inline int hsum_epi32(__m128i v)
+	{
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(v);
+	}
+
+	// SSE2 has no u8 x s8 product, both sides are widened to int16
+	void affine_sse2(const uint8_t in[], const int inDims, const int8_t* w, const int32_t b[],
+	                 const int outDims, int32_t out[])
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (int i = 0; i < outDims; i++) {
+			const int8_t* row = w + i * inDims;
+			__m128i sum = zero;
+			for (int j = 0; j < inDims; j += 16) {
+				const __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(in + j));
+				const __m128i y = _mm_load_si128(reinterpret_cast<const __m128i*>(row + j));
+				const __m128i xl = _mm_unpacklo_epi8(x, zero);
+				const __m128i xh = _mm_unpackhi_epi8(x, zero);
+				const __m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+				const __m128i yh = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+				sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(xl, yl), _mm_madd_epi16(xh, yh)));
+			}
+			out[i] = b[i] + hsum_epi32(sum);
+		}
+	}
+#endif
+
+#if defined(NNUE_AVX2)
+	// A row of 256 int16 is 16 registers, kept there over all the rows
+	TARGET_AVX2 void accumulate_avx2(int16_t acc[], const int16_t base[], const int add[], const int nadd,
+	                                 const int rem[], const int nrem)
+	{
+		const int Regs = HalfDims / 16;
+		__m256i r[Regs];
+		for (int k = 0; k < Regs; k++)
+			r[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base) + k);
+		for (int i = 0; i < nadd; i++) {
+			const __m256i* row = reinterpret_cast<const __m256i*>(nn->ftWeights[add[i]]);
+			for (int k = 0; k < Regs; k++)
+				r[k] = _mm256_add_epi16(r[k], _mm256_load_si256(row + k));
+		}
+		for (int i = 0; i < nrem; i++) {
+			const __m256i* row = reinterpret_cast<const __m256i*>(nn->ftWeights[rem[i]]);
+			for (int k = 0; k < Regs; k++)
+				r[k] = _mm256_sub_epi16(r[k], _mm256_load_si256(row + k));
+		}
+		for (int k = 0; k < Regs; k++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + k, r[k]);
+	}
+
+	// packs works within 128 bit lanes, the permutation puts the bytes back in order
+	TARGET_AVX2 void transform_avx2(const int16_t acc[], uint8_t out[])
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		for (int j = 0; j < HalfDims; j += 32) {
+			const __m256i a = _mm256_max_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + j)), zero);
+			const __m256i b = _mm256_max_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + j + 16)), zero);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(out + j),
+			                   _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8));
+		}
+	}
+
+	TARGET_AVX2 inline int hsum_epi32_avx2(const __m256i v)
+	{
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(s);
+	}
+
+	// The inputs are at most 127, so the pairs of maddubs never saturate
+	TARGET_AVX2 void affine_avx2(const uint8_t in[], const int inDims, const int8_t* w, const int32_t b[],
+	                             const int outDims, int32_t out[])
+	{
+		const __m256i ones = _mm256_set1_epi16(1);
+		for (int i = 0; i < outDims; i++) {
+			const int8_t* row = w + i * inDims;
+			__m256i sum = _mm256_setzero_si256();
+			for (int j = 0; j < inDims; j += 32) {
+				const __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(in + j));
+				const __m256i y = _mm256_load_si256(reinterpret_cast<const __m256i*>(row + j));
+				sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, y), ones));
+			}
+			out[i] = b[i] + hsum_epi32_avx2(sum);
+		}
+	}
+#endif
+
+#if defined(NNUE_SSE2)
+	AccumulateFn accumulate = accumulate_sse2;
+	TransformFn transform = transform_sse2;
+	AffineFn affine = affine_sse2;
+#else
+	AccumulateFn accumulate = accumulate_scalar;
+	TransformFn transform = transform_scalar;
+	AffineFn affine = affine_scalar;
+#endif
+
+	// propagate() returns the output of the network for the accumulators of
+	// the side to move and of the other side.
+	int propagate(const int16_t accUs[], const int16_t accThem[])
+	{
+		CACHE_LINE_ALIGNMENT uint8_t in0[2 * HalfDims];
+		CACHE_LINE_ALIGNMENT uint8_t in1[L1];
+		CACHE_LINE_ALIGNMENT uint8_t in2[L2];
+		int32_t out1[L1], out2[L2], out3[1];
+
+		transform(accUs, in0);
+		transform(accThem, in0 + HalfDims);
+
+		affine(in0, 2 * HalfDims, nn->w1[0], nn->b1, L1, out1);
+		clipped_relu(out1, L1, in1);
+		affine(in1, L1, nn->w2[0], nn->b2, L2, out2);
+		clipped_relu(out2, L2, in2);
+		affine(in2, L2, nn->w3[0], nn->b3, 1, out3);
+
+		return out3[0] / FV_SCALE;
+	}
+}
+
+template<> const int* Position::piece_values<EVALTYPE_APERY>();
+
+template<>
+void Position::init_evaluate<EVALTYPE_NNUE>()
+{
+	const char* const sources[] = { NN_BIN };
+	nn = static_cast<const Weights*>(
+		EvalImage::load(NN_IMG, NN_TAG, sources, 1, sizeof(Weights), read_weights));
+
+	if (nn == NULL) {
+		std::cerr << "Can't load " << NN_BIN << "." << std::endl;
+#if defined(CSADLL) || defined(CSA_DIRECT)
+		::MessageBox(NULL, "Can't load " NN_BIN "\nExiting.", "Error!", MB_OK);
+#endif	// defined(CSA_DLL) || defined(CSA_DIRECT)
+		exit(1);
+	}
+
+#if defined(NNUE_AVX2)
+	if (CpuHasAVX2) {
+		accumulate = accumulate_avx2;
+		transform = transform_avx2;
+		affine = affine_avx2;
+	}
+#endif
+}
+
+/// The piece values, used by the search, are the ones of Apery: the networks
+/// are trained on the same scale.
+
+template<>
+const int* Position::piece_values<EVALTYPE_NNUE>()
+{
+	return piece_values<EVALTYPE_APERY>();
+}
+
+/// Position::refresh_accumulator() computes the accumulator of the
+/// perspective of 'c' from scratch: the biases plus the rows of all the
+/// features of the position.
+
+void Position::refresh_accumulator(short acc[], const Color c) const
+{
+	int list0[MaxActive], list1[MaxActive];
+	int nlist = make_list_hand(HAND_B, HAND_W, list0, list1);
+	nlist = make_list_apery(list0, list1, nlist);
+
+	int* list = (c == BLACK) ? list0 : list1;
+	const int k = (c == BLACK) ? z2sq[king_square(BLACK)] : inv(z2sq[king_square(WHITE)]);
+	for (int i = 0; i < nlist; i++)
+		list[i] += k * fe_end;
+
+	accumulate(acc, nn->ftBiases, list, nlist, NULL, 0);
+}
+
+/// Position::eval_stage() does one part of a full evaluation, for "bench
+/// eval". SUMS computes both accumulators from scratch and runs the network.
+
+template<>
+int Position::eval_stage<EVALTYPE_NNUE>(EvalStage stage, EvalScratch& w) const
+{
+	switch (stage) {
+	case EVAL_STAGE_HAND:
+		w.nhand = make_list_hand(HAND_B, HAND_W, w.list0, w.list1);
+		return w.nhand;
+	case EVAL_STAGE_LIST:
+		w.nlist = make_list_apery(w.list0, w.list1, w.nhand);
+		return w.nlist;
+	case EVAL_STAGE_SUMS: {
+		int16_t acc[2][HalfDims];
+		int features[MaxActive];
+		for (int c = BLACK; c <= WHITE; c++) {
+			const int k = (c == BLACK) ? z2sq[king_square(BLACK)] : inv(z2sq[king_square(WHITE)]);
+			const int* list = (c == BLACK) ? w.list0 : w.list1;
+			for (int i = 0; i < w.nlist; i++)
+				features[i] = k * fe_end + list[i];
+			accumulate(acc[c], nn->ftBiases, features, w.nlist, NULL, 0);
+		}
+		const Color stm = side_to_move();
+		return propagate(acc[stm], acc[flip(stm)]);
+	}
+	case EVAL_STAGE_MATERIAL:		// the same for all evaluators, see Position::eval_stage()
+	case EVAL_STAGE_NB:
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+/// Position::update_eval_sums() computes the accumulators of the StateInfo.
+/// Like for Apery it walks back to a position whose accumulators are known,
+/// collecting the changed features on the way, and adds and subtracts their
+/// rows. A perspective whose king has moved on the way is computed from
+/// scratch, as are both when the walk can't go on or too many features have
+/// changed.
+
+template<>
+void Position::update_eval_sums<EVALTYPE_NNUE>() const
+{
+	FeatureDiff diff;
+	diff.nrem = diff.nadd = 0;
+	uint32_t h[2] = { HAND_B, HAND_W };		// hands of the position 's'
+	bool refresh[2] = { false, false };
+	const StateInfo* s = st;
+
+	for (;;) {
+		const Move m = s->lastMove;
+		if (s->previous == NULL || m == MOVE_NONE
+		 || diff.nrem > MaxDiffFeatures - 2 || diff.nadd > MaxDiffFeatures - 2) {
+			refresh[BLACK] = refresh[WHITE] = true;
+			break;
+		}
+		if (move_piece(m) == SOU) refresh[BLACK] = true;
+		if (move_piece(m) == GOU) refresh[WHITE] = true;
+		if (refresh[BLACK] && refresh[WHITE])
+			break;
+
+		diff.add_move(s, h);
+
+		s = s->previous;
+		if (s->evalSum[0] != EVAL_SUM_NONE)
+			break;
+	}
+
+	for (int c = BLACK; c <= WHITE; c++) {
+		if (refresh[c]) {
+			refresh_accumulator(st->accumulator[c], Color(c));
+			continue;
+		}
+
+		assert(diff.nrem == diff.nadd);
+		const int k = (c == BLACK) ? z2sq[king_square(BLACK)] : inv(z2sq[king_square(WHITE)]);
+		int add[MaxDiffFeatures], rem[MaxDiffFeatures];
+		for (int i = 0; i < diff.nadd; i++)
+			add[i] = k * fe_end + (c == BLACK ? diff.add0[i] : diff.add1[i]);
+		for (int i = 0; i < diff.nrem; i++)
+			rem[i] = k * fe_end + (c == BLACK ? diff.rem0[i] : diff.rem1[i]);
+
+		accumulate(st->accumulator[c], s->accumulator[c], add, diff.nadd, rem, diff.nrem);
+	}
+
+	// Another thread may look at the same position, the mark goes last
+	st->evalSum[0] = 0;
+}
+
+template<>
+int Position::evaluate<EVALTYPE_NNUE>(const Color us) const
+{
+	if (st->evalSum[0] == EVAL_SUM_NONE)
+		update_eval_sums<EVALTYPE_NNUE>();
+
+#if !defined(NDEBUG)
+	for (int c = BLACK; c <= WHITE; c++) {
+		short acc[NNUE_HALF_DIMENSIONS];
+		refresh_accumulator(acc, Color(c));
+		assert(!memcmp(acc, st->accumulator[c], sizeof(acc)));
+	}
+#endif
+
+	const Color stm = side_to_move();
+	const int score = propagate(st->accumulator[stm], st->accumulator[flip(stm)]);
+
+	return (us == stm) ? score : -score;
+}
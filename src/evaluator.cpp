@@ -0,0 +1,285 @@
+/*
+  NanohaMini, a USI shogi(japanese-chess) playing engine derived from Stockfish 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014-2016 Kazuyuki Kawabata
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NanohaMini is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+#include "evaluate.h"
+#include "position.h"
+#include "thread.h"
+#include "tt.h"
+
+// The evaluation functions are explicit specializations of the Position
+// templates, each one defined in its own object file: evaluate.cpp built with
+// -DEVAL_NANO and with -DEVAL_MINI, evaluate_apery.cpp and evaluate_nnue.cpp.
+template<> void Position::init_evaluate<EVALTYPE_NANO>();
+template<> void Position::init_evaluate<EVALTYPE_MINI>();
+template<> void Position::init_evaluate<EVALTYPE_APERY>();
+template<> void Position::init_evaluate<EVALTYPE_NNUE>();
+template<> const int* Position::piece_values<EVALTYPE_NANO>();
+template<> const int* Position::piece_values<EVALTYPE_MINI>();
+template<> const int* Position::piece_values<EVALTYPE_APERY>();
+template<> const int* Position::piece_values<EVALTYPE_NNUE>();
+template<> int Position::evaluate<EVALTYPE_NANO>(const Color us) const;
+template<> int Position::evaluate<EVALTYPE_MINI>(const Color us) const;
+template<> int Position::evaluate<EVALTYPE_APERY>(const Color us) const;
+template<> int Position::evaluate<EVALTYPE_NNUE>(const Color us) const;
+template<> int Position::eval_stage<EVALTYPE_NANO>(EvalStage s, EvalScratch& w) const;
+template<> int Position::eval_stage<EVALTYPE_MINI>(EvalStage s, EvalScratch& w) const;
+template<> int Position::eval_stage<EVALTYPE_APERY>(EvalStage s, EvalScratch& w) const;
+template<> int Position::eval_stage<EVALTYPE_NNUE>(EvalStage s, EvalScratch& w) const;
+
+// Piece values, indexed by Piece. They belong to the evaluation function and
+// are filled by Position::set_evaluator().
+Value PieceValueMidgame[32];
+Value PieceValueEndgame[32];
+
+namespace NanohaTbl {
+	int KomaValue[32];		// 駒の価値
+	int KomaValueEx[32];	// 取られたとき(捕獲されたとき)の価値
+	int KomaValuePro[32];	// 成る価値
+}
+
+EvalType Position::evalType = EVALTYPE_NB;
+
+namespace {
+
+	const char* const EvalNames[EVALTYPE_NB] = { "nano", "mini", "apery", "nnue" };
+
+	// A bound of |evaluation - material| for each evaluation function, the
+	// largest value seen over the evaluations of searches plus some headroom.
+	// 0 disables lazy_evaluate(): nnue has no material term.
+	const int PositionalBound[EVALTYPE_NB] = { 256, 80, 800, 0 };
+
+	// The unpromoted piece of each piece of the first player, 13 is unused
+	const int Unpromoted[16] = {
+		EMP, SFU, SKY, SKE, SGI, SKI, SKA, SHI, SOU, SFU, SKY, SKE, SGI, EMP, SKA, SHI
+	};
+}
+
+
+/// eval_type() converts the name of an evaluation function, the value of the
+/// USI option "EvalType", to an EvalType. Returns EVALTYPE_NB if unknown.
+
+EvalType eval_type(const std::string& name) {
+
+	for (int e = 0; e < EVALTYPE_NB; e++)
+		if (name == EvalNames[e])
+			return EvalType(e);
+
+	return EVALTYPE_NB;
+}
+
+const char* eval_type_name(EvalType e) {
+
+	return e < EVALTYPE_NB ? EvalNames[e] : "";
+}
+
+
+/// select_evaluator() switches to the evaluation function 'name' when it is not
+/// the current one, and loads its weights. The transposition table and the
+/// evaluation caches hold values of the previous function, so they are
+/// cleared. Returns true when the evaluation function has changed; the caller
+/// then has to reset the evaluation of its positions.
+
+bool select_evaluator(const std::string& name) {
+
+	const EvalType e = eval_type(name);
+
+	if (e == EVALTYPE_NB)
+	{
+		std::cerr << "Unknown EvalType " << name << ", keeping "
+		          << eval_type_name(Position::evaluator()) << "." << std::endl;
+		return false;
+	}
+	if (e == Position::evaluator())
+		return false;
+
+	Position::set_evaluator(e);
+	Position::init_evaluate();
+
+	TT.clear();
+	for (int i = 0; i < MAX_THREADS; i++)
+		Threads[i].evalCache.clear();
+
+	return true;
+}
+
+
+/// Position::set_evaluator() selects the evaluation function used by
+/// evaluate() and sets the piece values to its own ones. The weights are
+/// loaded by init_evaluate(), which may run later in another thread.
+
+void Position::set_evaluator(EvalType e) {
+
+	assert(e < EVALTYPE_NB);
+
+	const int* v = e == EVALTYPE_NANO ? piece_values<EVALTYPE_NANO>()
+	             : e == EVALTYPE_MINI ? piece_values<EVALTYPE_MINI>()
+	             : e == EVALTYPE_APERY ? piece_values<EVALTYPE_APERY>()
+	                                  : piece_values<EVALTYPE_NNUE>();
+	evalType = e;
+
+	for (int i = 0; i < 16; i++)
+	{
+		// Only FU, KY, KE, GI, KA and HI promote
+		const int pro = (i == EMP || i == SKI || (i & PROMOTED)) ? 0 : v[i | PROMOTED] - v[i];
+		const int ex = v[i] + v[Unpromoted[i]];
+
+		NanohaTbl::KomaValue[i]           =  v[i];
+		NanohaTbl::KomaValue[i | GOTE]    = -v[i];
+		NanohaTbl::KomaValueEx[i]         =  ex;
+		NanohaTbl::KomaValueEx[i | GOTE]  = -ex;
+		NanohaTbl::KomaValuePro[i]        =  pro;
+		NanohaTbl::KomaValuePro[i | GOTE] = -pro;
+
+		// The unused pieces 13 and 29 count as a gold, 16 as a king
+		const Value mg = Value(i == EMP ? 0 : i == 13 ? 2 * v[SKI] : ex);
+		PieceValueMidgame[i] = PieceValueEndgame[i] = mg;
+		PieceValueMidgame[i | GOTE] = PieceValueEndgame[i | GOTE] = (i == EMP ? Value(2 * v[SOU]) : mg);
+	}
+}
+
+
+/// Position::init_evaluate() loads the weights of the selected evaluation
+/// function.
+
+void Position::init_evaluate() {
+
+	switch (evalType) {
+	case EVALTYPE_NANO:  init_evaluate<EVALTYPE_NANO>();  break;
+	case EVALTYPE_MINI:  init_evaluate<EVALTYPE_MINI>();  break;
+	case EVALTYPE_APERY: init_evaluate<EVALTYPE_APERY>(); break;
+	case EVALTYPE_NNUE:  init_evaluate<EVALTYPE_NNUE>();  break;
+	case EVALTYPE_NB:
+	default: assert(false); break;
+	}
+}
+
+
+/// Position::evaluate() returns the static evaluation of the position from the
+/// point of view of 'us'. The evaluation function is chosen once per call by a
+/// switch, the functions themselves are not virtual.
+
+int Position::evaluate(const Color us) const {
+
+	switch (evalType) {
+	case EVALTYPE_NANO:  return evaluate<EVALTYPE_NANO>(us);
+	case EVALTYPE_MINI:  return evaluate<EVALTYPE_MINI>(us);
+	case EVALTYPE_APERY: return evaluate<EVALTYPE_APERY>(us);
+	case EVALTYPE_NNUE:  return evaluate<EVALTYPE_NNUE>(us);
+	case EVALTYPE_NB:
+	default: break;
+	}
+	assert(false);
+	return 0;
+}
+
+
+/// Position::eval_stage() does one part of a full evaluation of the position
+/// with the selected evaluation function, see EvalStage. The result only
+/// keeps the work from being optimized away.
+
+int Position::eval_stage(EvalStage s, EvalScratch& w) const {
+
+	if (s == EVAL_STAGE_MATERIAL)
+		return compute_material();
+
+	switch (evalType) {
+	case EVALTYPE_NANO:  return eval_stage<EVALTYPE_NANO>(s, w);
+	case EVALTYPE_MINI:  return eval_stage<EVALTYPE_MINI>(s, w);
+	case EVALTYPE_APERY: return eval_stage<EVALTYPE_APERY>(s, w);
+	case EVALTYPE_NNUE:  return eval_stage<EVALTYPE_NNUE>(s, w);
+	case EVALTYPE_NB:
+	default: break;
+	}
+	assert(false);
+	return 0;
+}
+
+
+/// Position::reset_evaluation() recomputes the material and forgets the sums
+/// of the evaluation terms of the position and of the positions before it,
+/// after the evaluation function has changed.
+
+void Position::reset_evaluation() {
+
+	material = compute_material();
+	for (StateInfo* s = st; s != NULL; s = s->previous)
+		s->evalSum[0] = EVAL_SUM_NONE;
+}
+
+
+/// Position::compute_material() computes the material from scratch, the sum of
+/// the values of all the pieces on the board and in the hands.
+
+int Position::compute_material() const {
+
+	int v = 0;
+	for (int kn = KNS_HI; kn <= KNE_FU; kn++)
+		v += NanohaTbl::KomaValue[knkind[kn]];
+
+	return v;
+}
+
+
+/// evaluate() is the evaluation entry point of the search. It looks the
+/// position up in the evaluation cache of the thread first.
+
+Value evaluate(const Position& pos, Value& margin) {
+
+	margin = VALUE_ZERO;
+
+	EvalCache& cache = Threads[pos.thread()].evalCache;
+	if (!cache.enabled())
+		return Value(pos.evaluate(pos.side_to_move()));
+
+	const Key key = EvalCache::key(pos.get_key(), pos.handValue<BLACK>());
+	Value v;
+	if (!cache.probe(key, v)) {
+		v = Value(pos.evaluate(pos.side_to_move()));
+		cache.store(key, v);
+	}
+	return v;
+}
+
+
+/// lazy_evaluate() is the first stage of the evaluation in qsearch(). The
+/// material alone, widened by the bound of the other terms, gives a range
+/// for the evaluation. When the range is outside (alpha, beta) it returns
+/// its end closest to the window, material - bound >= beta or material +
+/// bound <= alpha, and the full evaluation can be skipped. Otherwise it
+/// returns VALUE_NONE.
+
+Value lazy_evaluate(const Position& pos, Value alpha, Value beta) {
+
+	const int bound = PositionalBound[Position::evaluator()];
+	if (bound == 0)
+		return VALUE_NONE;
+
+	const int m = pos.side_to_move() == BLACK ? pos.get_material() : -pos.get_material();
+	if (m - bound >= beta)
+		return Value(m - bound);
+	if (m + bound <= alpha)
+		return Value(m + bound);
+
+	return VALUE_NONE;
+}
@@ -40,6 +40,8 @@ extern void benchmark(int argc, char* argv[]);
 extern void bench_mate(int argc, char* argv[]);
 extern void bench_genmove(int argc, char* argv[]);
 extern void bench_eval(int argc, char* argv[]);
+extern void bench_tt(int argc, char* argv[]);
+extern void evalbatch(int argc, char* argv[]);
 extern void solve_problem(int argc, char* argv[]);
 extern void test_qsearch(int argc, char* argv[]);
 extern void test_see(int argc, char* argv[]);
@@ -70,6 +72,12 @@ int main(int argc, char* argv[]) {
 	init_search();
 	Threads.init();
 
+#if defined(NANOHA)
+	// USI ȊÕ[h͏̊҂Ăn߂
+	if (argc >= 2)
+		wait_for_initialization();
+#endif
+
 	if (argc < 2)
 	{
 		// 1
@@ -96,6 +104,12 @@ int main(int argc, char* argv[]) {
 	else if (string(argv[1]) == "bench" && argc > 2 && string(argv[2]) == "eval") {
 		bench_eval(--argc, ++argv);
 	}
+	else if (string(argv[1]) == "bench" && argc > 2 && string(argv[2]) == "tt") {
+		bench_tt(--argc, ++argv);
+	}
+	else if (string(argv[1]) == "evalbatch") {
+		evalbatch(argc, argv);
+	}
 	else if (string(argv[1]) == "qsearch") {
 		test_qsearch(--argc, ++argv);
 	}
@@ -119,12 +133,20 @@ int main(int argc, char* argv[]) {
 		cout << "   bench genmove "
 		                 "[fen positions file = default] "
 		                 "[display moves = no]\n";
+		cout << "   bench eval "
+		                 "[fen positions file = default] "
+		                 "[display = no] [text or csv = text] [EvalType = current]\n";
 		cout << "   bench mate1 "
 		                 "[fen positions file = default] "
 		                 "[loop = yes] [display = no]\n";
 		cout << "   bench mate3 "
 		                 "[fen positions file = default] "
-		                 "[loop = yes] [display moves = no]" << endl;
+		                 "[loop = yes] [display moves = no]\n";
+		cout << "   bench tt "
+		                 "[hash size = 128] [threads = 1] [depth = 12] "
+		                 "[fen positions file = default] [bucket sizes = 4]\n";
+		cout << "   evalbatch <sfen positions file> [threads = cores] "
+		                 "[eval or qsearch = eval] [output file = -] [csv or bin = csv]" << endl;
 	}
 #else
 	cout << "Usage: stockfish bench [hash size = 128] [threads = 1] "
@@ -57,16 +57,17 @@ using namespace std;
 /// current date (in the format YYMMDD) is used as a version number.
 
 #if defined(NANOHA)
-#if defined(EVAL_NANO)
+// The name follows the default evaluation function (EVAL_DEFAULT in Makefile)
+#if defined(EVAL_DEFAULT_NANO)
 static const string AppName = "NanohaNano";
-static const string EngineVersion = "0.2.2.1";
-#elif defined(EVAL_MINI)
-static const string AppName = "NanohaMini";
-static const string EngineVersion = "0.2.2.1";
-#elif defined(EVAL_APERY)
+#elif defined(EVAL_DEFAULT_APERY)
 static const string AppName = "Nanopery";
-static const string EngineVersion = "0.2.2.1";
+#elif defined(EVAL_DEFAULT_NNUE)
+static const string AppName = "NanohaNNUE";
+#else
+static const string AppName = "NanohaMini";
 #endif
+static const string EngineVersion = "0.2.2.1";
 #else
 static const string AppName = "Stockfish";
 static const string EngineVersion = "2.1";
@@ -268,7 +269,8 @@ int input_available() {
 
 /// prefetch() preloads the given address in L1/L2 cache. This is a non
 /// blocking function and do not stalls the CPU waiting for data to be
-/// loaded from memory, that can be quite slow.
+/// loaded from memory, that can be quite slow. In shogi a TTCluster is one
+/// aligned cache line, so a single prefetch is enough.
 #if defined(NO_PREFETCH)
 
 void prefetch(char*) {}
@@ -284,7 +286,9 @@ void prefetch(char* addr) {
 #endif
 
 	_mm_prefetch(addr, _MM_HINT_T2);
+#if !defined(NANOHA)
 	_mm_prefetch(addr+64, _MM_HINT_T2); // 64 bytes ahead
+#endif
 }
 
 #endif
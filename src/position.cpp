@@ -39,15 +39,6 @@
 #include "thread.h"
 #include "tt.h"
 ///#include "ucioption.h"
-#if defined(NANOHA)
-#if defined(EVAL_NANO)
-#include "param_nano.h"
-#elif defined(EVAL_MINI)
-#include "param_mini.h"
-#elif defined(EVAL_APERY)
-#include "param_apery.h"
-#endif
-#endif
 using std::string;
 using std::cout;
 using std::endl;
@@ -68,74 +59,7 @@ Score Position::pieceSquareTable[16][64];
 
 // Material values arrays, indexed by Piece
 #if defined(NANOHA)
-const Value PieceValueMidgame[32] = {
-	VALUE_ZERO,
-	Value(DPawn   *2),
-	Value(DLance  *2),
-	Value(DKnight *2),
-	Value(DSilver *2),
-	Value(DGold   *2),
-	Value(DBishop *2),
-	Value(DRook   *2),
-	Value(DKing   *2), 
-	Value(DPawn   +DProPawn),
-	Value(DLance  +DProLance),
-	Value(DKnight +DProKnight),
-	Value(DSilver +DProSilver),
-	Value(DGold   *2),
-	Value(DBishop +DHorse),
-	Value(DRook   +DDragon),
-	Value(DKing   *2), 
-	Value(DPawn   *2),
-	Value(DLance  *2),
-	Value(DKnight *2),
-	Value(DSilver *2),
-	Value(DGold   *2),
-	Value(DBishop *2),
-	Value(DRook   *2),
-	Value(DKing   *2), 
-	Value(DPawn   +DProPawn),
-	Value(DLance  +DProLance),
-	Value(DKnight +DProKnight),
-	Value(DSilver +DProSilver),
-	Value(DGold   *2),
-	Value(DBishop +DHorse),
-	Value(DRook   +DDragon),
-};
-const Value PieceValueEndgame[32] = {
-	VALUE_ZERO,
-	Value(DPawn   *2),
-	Value(DLance  *2),
-	Value(DKnight *2),
-	Value(DSilver *2),
-	Value(DGold   *2),
-	Value(DBishop *2),
-	Value(DRook   *2),
-	Value(DKing   *2), 
-	Value(DPawn   +DProPawn),
-	Value(DLance  +DProLance),
-	Value(DKnight +DProKnight),
-	Value(DSilver +DProSilver),
-	Value(DGold   *2),
-	Value(DBishop +DHorse),
-	Value(DRook   +DDragon),
-	Value(DKing   *2), 
-	Value(DPawn   *2),
-	Value(DLance  *2),
-	Value(DKnight *2),
-	Value(DSilver *2),
-	Value(DGold   *2),
-	Value(DBishop *2),
-	Value(DRook   *2),
-	Value(DKing   *2), 
-	Value(DPawn   +DProPawn),
-	Value(DLance  +DProLance),
-	Value(DKnight +DProKnight),
-	Value(DSilver +DProSilver),
-	Value(DGold   *2),
-	Value(DBishop +DHorse),
-	Value(DRook   +DDragon),
-};
+// (]֐ɂĕς̂ evaluator.cpp Œ`)
 unsigned char Position::DirTbl[0xA0][0x100];	// p[from][to]
 
 #else
@@ -468,6 +392,8 @@ void Position::from_fen(const string& fenStr, bool isChess960) {
 	st->hand = hand[sideToMove].h;
 	st->effect = (sideToMove == BLACK) ? effectB[kingG] : effectW[kingS];
 	material = compute_material();
+	// ]l̘a͍ŏ evaluate() ŌvZ
+	st->evalSum[0] = EVAL_SUM_NONE;
 #else
 	st->pawnKey = compute_pawn_key();
 	st->materialKey = compute_material_key();
@@ -1746,6 +1672,11 @@ void Position::do_null_move(StateInfo& backupSt) {
 #endif
 	backupSt.previous = st->previous;
 	backupSt.pliesFromNull = st->pliesFromNull;
+#if defined(NANOHA)
+	// ǖʂ͕ςȂ̂ŕ]l̘a͂̂܂܎g. backupSt ̍vZ͂Ȃ
+	backupSt.evalSum[0] = EVAL_SUM_NONE;
+	backupSt.lastMove = MOVE_NONE;
+#endif
 	st->previous = &backupSt;
 
 #if !defined(NANOHA)
@@ -2441,6 +2372,7 @@ bool Position::is_ok(int* failedStep) const {
 	// What features of the position should be verified?
 	const bool debugAll = false;
 #if defined(NANOHA)
+	const bool debugBitboards       = debugAll || false;
 	const bool debugKingCount       = debugAll || false;
 	const bool debugKingCapture     = debugAll || false;
 #else
@@ -2527,6 +2459,30 @@ bool Position::is_ok(int* failedStep) const {
 	// TODO:ʂ3ȏ̗sȏ
 //  if (debugCheckerCount && count_1s<CNT32>(st->checkersBB) > 2)
 //      return false;
+
+	// Bitboards OK?
+	if (failedStep) (*failedStep)++;
+	if (debugBitboards)
+	{
+		// rbg{[h ban[] ƈv邩
+		for (int suji = 0x10; suji <= 0x90; suji += 0x10)
+			for (int dan = 1; dan <= 9; dan++)
+			{
+				const int z = suji + dan;
+				const int i = bb81_index(z);
+				if (occupiedBB.is_set(i) != (ban[z] != EMP))
+					return false;
+				for (int p = EMP + 1; p <= GRY; p++)
+					if (pieceBB[p].is_set(i) != (ban[z] == p))
+						return false;
+			}
+
+		// ̂
+		for (int f = 0; f < 9; f++)
+			for (Color c = BLACK; c <= WHITE; c++)
+				if (((pawnFiles[c] >> f) & 1) != (pieceBB[c == BLACK ? SFU : GFU] & file_bb81(f)).any())
+					return false;
+	}
 #else
 	// Do both sides have exactly one king?
 	if (failedStep) (*failedStep)++;
@@ -24,9 +24,11 @@
 #if defined(NANOHA)
 #include <iostream>
 #include <cstdio>
+#include "bitboard81.h"
 #else
 #include "bitboard.h"
 #endif
+#include "evaluate.h"
 #include "move.h"
 #include "types.h"
 
@@ -54,6 +56,11 @@ struct CheckInfo {
 ///
 class Position;
 
+#if defined(NANOHA)
+const int EVAL_SUM_NONE = -0x7fffffff - 1;	// StateInfo ̕]l̘avZł邱Ƃ
+const int NNUE_HALF_DIMENSIONS = 256;		// ]֐ nnue  accumulator ̎(Е̋ʂ̕)
+#endif
+
 struct StateInfo {
 #if defined(NANOHA)
 	int gamePly;
@@ -63,6 +70,14 @@ struct StateInfo {
 	uint32_t hand;
 	uint32_t effect;
 	Key key;
+	// ]l̊e̘a. evaluate() Őǖʂ̒l獷ŋ߂.
+	// g͕]֐ɂ. nano/mini  KP(܂) PP ̘aAapery 
+	// KK  KKP ̘aƐʁAʂ猩 KPP ̘a. [0] vZ̈˂
+	int evalSum[3];
+	Move lastMove;		// ̋ǖʂɎ
+	// ]֐ nnue  accumulator(ʁAʂ猩1wڂ̘a). evalSum[0] 
+	// vZ̈˂. 傫̂ do_move() ł̓Rs[Aevaluate() Őǖʂ狁߂
+	short accumulator[2][NNUE_HALF_DIMENSIONS];
 #else
 	Key pawnKey, materialKey;
 	Value npMaterial[2];
@@ -80,6 +95,7 @@ struct StateInfo {
 #if defined(NANOHA)
 // ֐
 extern void init_application_once();	// st@CNɍs.
+extern void wait_for_initialization();	// N̏̊҂.
 #endif
 
 /// The position data structure. A position consists of the following data:
@@ -299,14 +315,23 @@ public:
 	MoveStack *generate_evasion_rest2_MoveAi(const Color us, MoveStack *mBuf, effect_t effect);
 	MoveStack *generate_evasion_rest2_DropAi(const Color us, MoveStack *mBuf, effect_t effect, int &check_pos);
 
-	// ǖʂ̕]
+	// ǖʂ̕]. ]֐ƂɈȉ̃ev[gꉻĎ(evaluate.cpp,
+	// evaluate_apery.cpp, evaluate_nnue.cpp)Aevaluate() ȂǂI΂Ă]֐ɐU蕪(evaluator.cpp)
+	static EvalType evaluator() { return evalType; }
+	static void set_evaluator(EvalType e);
 	static void init_evaluate();
-#if defined(EVAL_APERY)
+	void reset_evaluation();
+	template<EvalType E> static void init_evaluate();
+	template<EvalType E> static const int* piece_values();
+	template<EvalType E> int make_list(int * pscore, int list0[], int list1[] ) const;
 	int make_list_apery(int list0[], int list1[], int nlist) const;
-#else
-	int make_list(int * pscore, int list0[], int list1[] ) const;
-#endif
+	template<EvalType E> void compute_eval_sums(int sum[3]) const;
+	template<EvalType E> void update_eval_sums() const;
+	void refresh_accumulator(short acc[], const Color c) const;	// nnue  accumulator ꂩ狁߂(c ̋ʂ猩)
+	template<EvalType E> int evaluate(const Color us) const;
 	int evaluate(const Color us) const;
+	template<EvalType E> int eval_stage(EvalStage s, EvalScratch& w) const;
+	int eval_stage(EvalStage s, EvalScratch& w) const;	// ]̈ꕔs(bench eval p)
 
 	// 딻(bInaniwa ɃZbg邽 const łȂ)
 	bool IsInaniwa(const Color us);
@@ -432,6 +457,8 @@ private:
 	void init_position(const unsigned char board_ori[9][9], const int Mochigoma_ori[]);
 	void make_pin_info();
 	void init_effect();
+	void init_bitboards();
+	void toggle_bb(Piece p, int z);
 #endif
 
 	// Helper functions for doing and undoing moves
@@ -488,6 +515,9 @@ private:
 #define IsCheckG()	EXIST_EFFECT(effectB[kingG])	/* ʂɉ肪Ă邩? */
 	int pin[16*10];					// s(ƌ藼p)
 	Hand hand[2];					// 
+	Bitboard81 pieceBB[GRY+1];		// ނƂ̔Տ̈ʒu(ban[] Ɠe)
+	Bitboard81 occupiedBB;			// ̂ʒu
+	int pawnFiles[2];				// ̂(bit0:1 ` bit8:9)
 #define handS	hand[BLACK]
 #define handG	hand[WHITE]
 	PieceKind_t knkind[MAX_PIECENUMBER+1];	// knkind[num] : ԍnum̋(EMP(0x00) ` GRY(0x1F))
@@ -567,6 +597,7 @@ private:
 	static Key zobExclusion;		// NULL MOVEǂʂ
 #if defined(NANOHA)
 	static unsigned char DirTbl[0xA0][0x100];	// p[from][to]
+	static EvalType evalType;					// I΂Ă]֐
 
 	// 萶pe[u
 	static const struct ST_OuteMove2 {
@@ -909,14 +940,18 @@ inline int Position::SkipOverEMP(int pos, const int dir) const {
 // `FbN(true:pos̋؂ɕ遁ɂȂAfalse:pos̋؂ɕȂ)
 inline bool Position::is_double_pawn(const Color us, const int pos) const
 {
-	const Piece *p = &(ban[(pos & ~0x0F)+1]);
-	Piece pawn = (us == BLACK) ? SFU : GFU;
-	for (int i = 0; i < 9; i++) {
-		if (*p++ == pawn) {
-			return true;
-		}
-	}
-	return false;
+	return (pawnFiles[us] >> ((pos >> 4) - 1)) & 1;
+}
+
+// ʒuz̋prbg{[hɒuA܂͎菜
+inline void Position::toggle_bb(const Piece p, const int z)
+{
+	const int i = bb81_index(z);
+	pieceBB[p].toggle(i);
+	occupiedBB.toggle(i);
+	// ͂Ȃ̂ŁA؂͈̕ꖇ
+	if (p == SFU) pawnFiles[BLACK] ^= 1 << ((z >> 4) - 1);
+	if (p == GFU) pawnFiles[WHITE] ^= 1 << ((z >> 4) - 1);
 }
 
 // ֘A
@@ -406,6 +406,21 @@ int64_t perft(Position& pos, Depth depth) {
 }
 
 
+#if defined(NANOHA)
+/// qsearch_value() returns the value of a quiescence search of the position
+/// with a full window, from the point of view of the side to move. It is safe
+/// to call from several threads at once, the TT is shared between them.
+
+Value qsearch_value(Position& pos) {
+
+	SearchStack ss[PLY_MAX_PLUS_2];
+
+	memset(ss, 0, 4 * sizeof(SearchStack));
+	return qsearch<PV>(pos, ss+1, -VALUE_INFINITE, VALUE_INFINITE, DEPTH_ZERO);
+}
+#endif
+
+
 /// think() is the external interface to Stockfish's search, and is called when
 /// the program receives the UCI 'go' command. It initializes various global
 /// variables, and calls id_loop(). It returns false when a "quit" command is
@@ -516,6 +531,7 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 
 	// Set a new TT size if changed
 	TT.set_size(Options["Hash"].value<int>());
+	TT.set_replacement(Options["TTReplacePolicy"].value<int>(), Options["TTBucketSize"].value<int>());
 
 	if (Options["Clear Hash"].value<bool>())
 	{
@@ -571,6 +587,23 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 		LogFile.close();
 	}
 
+#if defined(NANOHA)
+	// Report how often the evaluation caches of the search threads were hit
+	uint64_t evalProbes = 0, evalHits = 0;
+	for (int i = 0; i < Threads.size(); i++)
+	{
+		evalProbes += Threads[i].evalCache.probe_count();
+		evalHits += Threads[i].evalCache.hit_count();
+	}
+	if (evalProbes)
+	{
+		std::stringstream s;
+		s << "info string evalcache hits " << evalHits << "/" << evalProbes << " ("
+		  << std::setprecision(1) << std::fixed << evalHits * 100.0 / evalProbes << "%)";
+		cout << s.str() << endl;
+	}
+#endif
+
 	// This makes all the threads to go to sleep
 	Threads.set_size(1);
 
@@ -839,6 +872,9 @@ namespace {
 		int64_t nodes;
 		StateInfo st;
 		const TTEntry *tte;
+#if defined(NANOHA)
+		TTEntry ttEntry; // Private copy of the probed entry, see TTEntry
+#endif
 		Key posKey;
 		Move ttMove, move, excludedMove, threatMove;
 		Depth ext, newDepth;
@@ -949,12 +985,12 @@ namespace {
 		excludedMove = ss->excludedMove;
 #if defined(NANOHA)
 		posKey = excludedMove != MOVE_NONE ? pos.get_exclusion_key() : pos.get_key();
-		tte = TT.probe(posKey, pos.handValue_of_side());
+		tte = TT.probe(posKey, pos.handValue_of_side(), ttEntry);
 #else
 		posKey = excludedMove ? pos.get_exclusion_key() : pos.get_key();
 		tte = TT.probe(posKey);
 #endif
-		ttMove = RootNode ? Rml[MultiPVIteration].pv[0] : tte ? tte->move() : MOVE_NONE;
+		ttMove = RootNode ? Rml[MultiPVIteration].pv[0] : tte ? tte->move(pos) : MOVE_NONE;
 
 		// At PV nodes we check for exact scores, while at non-PV nodes we check for
 		// a fail high/low. Biggest advantage at probing at PV nodes is to have a
@@ -963,7 +999,11 @@ namespace {
 		if (!RootNode && tte && (PvNode ? tte->depth() >= depth && tte->type() == VALUE_TYPE_EXACT
 		                                : can_return_tt(tte, depth, beta, ss->ply)))
 		{
+#if defined(NANOHA)
+			TT.refresh(posKey, pos.handValue_of_side());
+#else
 			TT.refresh(tte);
+#endif
 			ss->bestMove = move = ttMove; // Can be MOVE_NONE
 			value = value_from_tt(tte->value(), ss->ply);
 
@@ -982,10 +1022,28 @@ namespace {
 			return value;
 		}
 
+#if defined(NANOHA)
+		// No entry for this hand, but an entry for the same board with a hand
+		// that dominates or is dominated by ours may still give a bound.
+		if (!PvNode && !tte)
+		{
+			const TTEntry* dte = TT.probe_dominance(posKey, pos.handValue_of_side(), ttEntry);
+			if (dte && can_return_tt(dte, depth, beta, ss->ply))
+			{
+				ss->bestMove = MOVE_NONE;
+				return value_from_tt(dte->value(), ss->ply);
+			}
+		}
+#endif
+
 		// Step 5. Evaluate the position statically and update parent's gain statistics
 		if (inCheck)
 			ss->eval = ss->evalMargin = VALUE_NONE;
+#if defined(NANOHA)
+		else if (tte && tte->static_value() != VALUE_NONE)
+#else
 		else if (tte)
+#endif
 		{
 			assert(tte->static_value() != VALUE_NONE);
 
@@ -997,7 +1055,11 @@ namespace {
 		{
 			refinedValue = ss->eval = evaluate(pos, ss->evalMargin);
 #if defined(NANOHA)
-			TT.store(posKey, pos.handValue_of_side(), VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
+			// qsearch()  lazy_evaluate() ŕ]Ȃǖʂ̃Ggɂ͕]lȂ. l͂̂܂܎g
+			if (tte)
+				refinedValue = refine_eval(tte, ss->eval, ss->ply);
+			else
+				TT.store(posKey, pos.handValue_of_side(), VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
 #else
 			TT.store(posKey, VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
 #endif
@@ -1159,7 +1221,7 @@ namespace {
 			ss->skipNullMove = false;
 
 #if defined(NANOHA)
-			tte = TT.probe(posKey, pos.handValue_of_side());
+			tte = TT.probe(posKey, pos.handValue_of_side(), ttEntry);
 #else
 			tte = TT.probe(posKey);
 #endif
@@ -1224,6 +1286,12 @@ split_point_start: // At split points actual search starts from here
 			else
 				moveCount++;
 
+#if defined(NANOHA)
+			// Start loading the cluster of the child position now. The pruning
+			// tests and do_move() below hide most of the memory latency.
+			prefetch(reinterpret_cast<char*>(TT.first_entry(pos.calc_hash_no_move(move))));
+#endif
+
 			if (RootNode)
 			{
 				// This is used by time management
@@ -1576,11 +1644,15 @@ split_point_start: // At split points actual search starts from here
 		Value bestValue, value, evalMargin, futilityValue, futilityBase;
 #if defined(NANOHA)
 		bool inCheck, givesCheck, evasionPrunable;
+		bool lazyEval = false;
 		MYASSERT(ss);
 #else
 		bool inCheck, enoughMaterial, givesCheck, evasionPrunable;
 #endif
 		const TTEntry* tte;
+#if defined(NANOHA)
+		TTEntry ttEntry; // Private copy of the probed entry, see TTEntry
+#endif
 		Depth ttDepth;
 		ValueType vt;
 		Value oldAlpha = alpha;
@@ -1630,11 +1702,11 @@ split_point_start: // At split points actual search starts from here
 		// Transposition table lookup. At PV nodes, we don't use the TT for
 		// pruning, but only for move ordering.
 #if defined(NANOHA)
-		tte = TT.probe(pos.get_key(), pos.handValue_of_side());
+		tte = TT.probe(pos.get_key(), pos.handValue_of_side(), ttEntry);
 #else
 		tte = TT.probe(pos.get_key());
 #endif
-		ttMove = (tte ? tte->move() : MOVE_NONE);
+		ttMove = (tte ? tte->move(pos) : MOVE_NONE);
 
 		if (!PvNode && tte && can_return_tt(tte, ttDepth, beta, ss->ply))
 		{
@@ -1642,6 +1714,15 @@ split_point_start: // At split points actual search starts from here
 			return value_from_tt(tte->value(), ss->ply);
 		}
 
+#if defined(NANOHA)
+		if (!PvNode && !tte)
+		{
+			const TTEntry* dte = TT.probe_dominance(pos.get_key(), pos.handValue_of_side(), ttEntry);
+			if (dte && can_return_tt(dte, ttDepth, beta, ss->ply))
+				return value_from_tt(dte->value(), ss->ply);
+		}
+#endif
+
 		// Evaluate the position statically
 		if (inCheck)
 		{
@@ -1653,13 +1734,27 @@ split_point_start: // At split points actual search starts from here
 		}
 		else
 		{
+#if defined(NANOHA)
+			if (tte && tte->static_value() != VALUE_NONE)
+#else
 			if (tte)
+#endif
 			{
 				assert(tte->static_value() != VALUE_NONE);
 
 				evalMargin = tte->static_value_margin();
 				ss->eval = bestValue = tte->static_value();
 			}
+#if defined(NANOHA)
+			// 肾ŕ]l͈̔͂ [alpha, beta] ̊Oƕ΁A]֐Ŝ͌vZȂ.
+			// ss->eval ͈͂̔͂̒[(܂͉)ɂȂ. u\ɂ͕]lȂœo^
+			else if (!PvNode && (bestValue = lazy_evaluate(pos, alpha, beta)) != VALUE_NONE)
+			{
+				ss->eval = bestValue;
+				evalMargin = VALUE_ZERO;
+				lazyEval = true;
+			}
+#endif
 			else
 				ss->eval = bestValue = evaluate(pos, evalMargin);
 
@@ -1668,7 +1763,8 @@ split_point_start: // At split points actual search starts from here
 			{
 				if (!tte)
 #if defined(NANOHA)
-					TT.store(pos.get_key(), pos.handValue_of_side(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE, ss->eval, evalMargin);
+					TT.store(pos.get_key(), pos.handValue_of_side(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE,
+					         lazyEval ? VALUE_NONE : ss->eval, lazyEval ? VALUE_NONE : evalMargin);
 #else
 					TT.store(pos.get_key(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE, ss->eval, evalMargin);
 #endif
@@ -1745,6 +1841,12 @@ split_point_start: // At split points actual search starts from here
 					continue;
 			}
 
+#if defined(NANOHA)
+			// The move survived futility pruning, start loading the cluster of
+			// the child position while SEE and the legality test run.
+			prefetch(reinterpret_cast<char*>(TT.first_entry(pos.calc_hash_no_move(move))));
+#endif
+
 			// Detect non-capture evasions that are candidate to be pruned
 			evasionPrunable =   !PvNode
 			                 && inCheck
@@ -1841,7 +1943,8 @@ split_point_start: // At split points actual search starts from here
 		     : bestValue >= beta ? VALUE_TYPE_LOWER : VALUE_TYPE_EXACT;
 
 #if defined(NANOHA)
-		TT.store(pos.get_key(), pos.handValue_of_side(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move, ss->eval, evalMargin);
+		TT.store(pos.get_key(), pos.handValue_of_side(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move,
+		         lazyEval ? VALUE_NONE : ss->eval, lazyEval ? VALUE_NONE : evalMargin);
 #else
 		TT.store(pos.get_key(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move, ss->eval, evalMargin);
 #endif
@@ -2206,7 +2309,8 @@ split_point_start: // At split points actual search starts from here
 		s << " nodes " << nodes
 		  << " nps "   << (t > 0 ? int(nodes * 1000 / t) : 0)
 #if defined(NANOHA)
-		  << " time "  << (t > 0 ? t : 1);
+		  << " time "  << (t > 0 ? t : 1)
+		  << " hashfull " << TT.hashfull();
 #else
 		  << " time "  << t;
 #endif
@@ -2553,7 +2657,10 @@ split_point_start: // At split points actual search starts from here
 	void RootMove::extract_pv_from_tt(Position& pos) {
 
 		StateInfo state[PLY_MAX_PLUS_2], *st = state;
-		TTEntry* tte;
+		const TTEntry* tte;
+#if defined(NANOHA)
+		TTEntry ttEntry;
+#endif
 		int ply = 1;
 		Move m = pv[0];
 
@@ -2565,13 +2672,13 @@ split_point_start: // At split points actual search starts from here
 
 #if defined(NANOHA)
 		int dummy = 0;
-		while (   (tte = TT.probe(pos.get_key(), pos.handValue_of_side())) != NULL
+		while (   (tte = TT.probe(pos.get_key(), pos.handValue_of_side(), ttEntry)) != NULL
 #else
 		while (   (tte = TT.probe(pos.get_key())) != NULL
 #endif
-		       && tte->move() != MOVE_NONE
+		       && tte->move(pos) != MOVE_NONE
 #if defined(NANOHA)
-		       && pos.pl_move_is_legal(tte->move())
+		       && pos.pl_move_is_legal(tte->move(pos))
 #else
 		       && pos.is_pseudo_legal(tte->move())
 		       && pos.pl_move_is_legal(tte->move(), pos.pinned_pieces())
@@ -2583,8 +2690,9 @@ split_point_start: // At split points actual search starts from here
 		       && (!pos.is_draw<false>() || ply < 2))
 #endif
 		{
-			pv.push_back(tte->move());
-			pos.do_move(tte->move(), *st++);
+			m = tte->move(pos);
+			pv.push_back(m);
+			pos.do_move(m, *st++);
 			ply++;
 		}
 		pv.push_back(MOVE_NONE);
@@ -2599,7 +2707,10 @@ split_point_start: // At split points actual search starts from here
 	void RootMove::insert_pv_in_tt(Position& pos) {
 
 		StateInfo state[PLY_MAX_PLUS_2], *st = state;
-		TTEntry* tte;
+		const TTEntry* tte;
+#if defined(NANOHA)
+		TTEntry ttEntry;
+#endif
 		Key k;
 		Value v, m = VALUE_NONE;
 		int ply = 0;
@@ -2609,13 +2720,13 @@ split_point_start: // At split points actual search starts from here
 		do {
 			k = pos.get_key();
 #if defined(NANOHA)
-			tte = TT.probe(k, pos.handValue_of_side());
+			tte = TT.probe(k, pos.handValue_of_side(), ttEntry);
 #else
 			tte = TT.probe(k);
 #endif
 
 			// Don't overwrite existing correct entries
-			if (!tte || tte->move() != pv[ply])
+			if (!tte || tte->move(pos) != pv[ply])
 			{
 				v = (pos.in_check() ? VALUE_NONE : evaluate(pos, m));
 #if defined(NANOHA)
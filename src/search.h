@@ -70,6 +70,9 @@ struct SearchLimits {
 
 extern void init_search();
 extern int64_t perft(Position& pos, Depth depth);
+#if defined(NANOHA)
+extern Value qsearch_value(Position& pos);
+#endif
 extern bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]);
 
 #endif // !defined(SEARCH_H_INCLUDED)
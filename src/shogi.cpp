@@ -26,15 +26,9 @@
 #include <cassert>
 #include "position.h"
 #include "tt.h"
+#include "thread.h"
 #include "book.h"
 #include "ucioption.h"
-#if defined(EVAL_NANO)
-#include "param_nano.h"
-#elif defined(EVAL_MINI)
-#include "param_mini.h"
-#elif defined(EVAL_APERY)
-#include "param_apery.h"
-#endif
 
 ///#define DEBUG_GENERATE
 
@@ -62,6 +56,20 @@ void disp_trace(int n)
 #endif
 
 namespace NanohaTbl {
+	// Ȃ̂͂̍W(0x11`0x99)ڂ̔ԍ(0`80)
+	const short z2sq[] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1,  0,  9, 18, 27, 36, 45, 54, 63, 72, -1, -1, -1, -1, -1, -1,
+		-1,  1, 10, 19, 28, 37, 46, 55, 64, 73, -1, -1, -1, -1, -1, -1,
+		-1,  2, 11, 20, 29, 38, 47, 56, 65, 74, -1, -1, -1, -1, -1, -1,
+		-1,  3, 12, 21, 30, 39, 48, 57, 66, 75, -1, -1, -1, -1, -1, -1,
+		-1,  4, 13, 22, 31, 40, 49, 58, 67, 76, -1, -1, -1, -1, -1, -1,
+		-1,  5, 14, 23, 32, 41, 50, 59, 68, 77, -1, -1, -1, -1, -1, -1,
+		-1,  6, 15, 24, 33, 42, 51, 60, 69, 78, -1, -1, -1, -1, -1, -1,
+		-1,  7, 16, 25, 34, 43, 52, 61, 70, 79, -1, -1, -1, -1, -1, -1,
+		-1,  8, 17, 26, 35, 44, 53, 62, 71, 80, -1, -1, -1, -1, -1, -1,
+	};
+
 	// ̒`
 	const int Direction[32] = {
 		DIR00, DIR01, DIR02, DIR03, DIR04, DIR05, DIR06, DIR07,
@@ -70,116 +78,6 @@ namespace NanohaTbl {
 		DIR00, DIR01, DIR02, DIR03, DIR04, DIR05, DIR06, DIR07,
 	};
 
-#if !defined(TSUMESOLVER)
-	// ̉l
-	const int KomaValue[32] = {
-		 0,
-		 DPawn,
-		 DLance,
-		 DKnight,
-		 DSilver,
-		 DGold,
-		 DBishop,
-		 DRook,
-		 DKing,
-		 DProPawn,
-		 DProLance,
-		 DProKnight,
-		 DProSilver,
-		 0,
-		 DHorse,
-		 DDragon,
-		 0,
-		-DPawn,
-		-DLance,
-		-DKnight,
-		-DSilver,
-		-DGold,
-		-DBishop,
-		-DRook,
-		-DKing,
-		-DProPawn,
-		-DProLance,
-		-DProKnight,
-		-DProSilver,
-		-0,
-		-DHorse,
-		-DDragon,
-	};
-
-	// ꂽƂ(ߊlꂽƂ)̉l
-	const int KomaValueEx[32] = {
-		 0 + 0,
-		 DPawn + DPawn,
-		 DLance + DLance,
-		 DKnight + DKnight,
-		 DSilver + DSilver,
-		 DGold + DGold,
-		 DBishop + DBishop,
-		 DRook + DRook,
-		 DKing + DKing,
-		 DProPawn + DPawn,
-		 DProLance + DLance,
-		 DProKnight + DKnight,
-		 DProSilver + DSilver,
-		 0 + 0,
-		 DHorse + DBishop,
-		 DDragon + DRook,
-		 0 + 0,
-		-DPawn	-DPawn,
-		-DLance	-DLance,
-		-DKnight	-DKnight,
-		-DSilver	-DSilver,
-		-DGold	-DGold,
-		-DBishop	-DBishop,
-		-DRook	-DRook,
-		-DKing	-DKing,
-		-DProPawn	-DPawn,
-		-DProLance	-DLance,
-		-DProKnight	-DKnight,
-		-DProSilver	-DSilver,
-		-0	-0,
-		-DHorse	-DBishop,
-		-DDragon	-DRook,
-	};
-
-	// 鉿l
-	const int KomaValuePro[32] = {
-		 0,
-		 DProPawn - DPawn,
-		 DProLance - DLance,
-		 DProKnight - DKnight,
-		 DProSilver - DSilver,
-		 0,
-		 DHorse - DBishop,
-		 DDragon - DRook,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		-(DProPawn - DPawn),
-		-(DProLance - DLance),
-		-(DProKnight - DKnight),
-		-(DProSilver - DSilver),
-		 0,
-		-(DHorse - DBishop),
-		-(DDragon - DRook),
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-		 0,
-	};
-#endif//#if !defined(TSUMESOLVER)
-
 	// Historyindexϊp
 	const int Piece2Index[32] = {	// ̎ނɕϊ({ƁAǁA\AS}Ɠꎋ)
 		EMP, SFU, SKY, SKE, SGI, SKI, SKA, SHI,
@@ -223,11 +121,26 @@ int foutput_log(FILE *fp, const char *fmt, ...)
 	return ret;
 }
 
+namespace {
+	// u\̊m. 傫Ȓu\ł̓NAɎԂ
+	void init_tt()
+	{
+		TT.set_size(Options["Hash"].value<int>());
+	}
+}
+
 // st@CNɍs.
+// Ԃ̂]xNg̓ǂݍ݁A1lߗpe[u̍쐬ƒu\̊mۂ
+// ʃXbhōsAusi/isready ɂł悤ɂ. 
+// wait_for_initialization() ő҂.
 void init_application_once()
 {
-	Position::init_evaluate();	// ]xNg̓ǂݍ
-	Position::initMate1ply();
+	// ]֐ EvalType IvV̊l̂. ̉l͂Ō܂
+	const EvalType e = eval_type(Options["EvalType"].value<std::string>());
+	Position::set_evaluator(e != EVALTYPE_NB ? e : EVALTYPE_MINI);
+	Threads.start_task(Position::init_evaluate);	// ]xNg̓ǂݍ
+	Threads.start_task(Position::initMate1ply);
+	Threads.start_task(init_tt);
 
 // Ճt@C̓ǂݍ
 	if (book == NULL) {
@@ -254,6 +167,13 @@ void init_application_once()
 	}
 }
 
+// init_application_once() ʃXbhŎn߂̊҂.
+// ]֐A1l߁Au\gOƁAu\̃IvVςOɌĂ.
+void wait_for_initialization()
+{
+	Threads.wait_for_tasks();
+}
+
 // ֌W
 void Position::init_position(const unsigned char board_ori[9][9], const int Mochigoma_ori[])
 {
@@ -400,6 +320,9 @@ void Position::init_position(const unsigned char board_ori[9][9], const int Moch
 	// effectB/effectW̏
 	init_effect();
 
+	// rbg{[h̏
+	init_bitboards();
+
 	// s̏
 	make_pin_info();
 }
@@ -469,6 +392,20 @@ void Position::make_pin_info()
 #undef ADDKING2
 }
 
+// ban[] rbg{[h
+void Position::init_bitboards()
+{
+	for (int p = EMP; p <= GRY; p++) pieceBB[p] = Bitboard81(0, 0);
+	occupiedBB = Bitboard81(0, 0);
+	pawnFiles[BLACK] = pawnFiles[WHITE] = 0;
+
+	for (int suji = 0x10; suji <= 0x90; suji += 0x10) {
+		for (int dan = 1 ; dan <= 9 ; dan++) {
+			if (ban[suji + dan] != EMP) toggle_bb(ban[suji + dan], suji + dan);
+		}
+	}
+}
+
 // ֌W
 // effectB/effectW̏
 void Position::init_effect()
@@ -810,6 +747,9 @@ void Position::do_move(Move m, StateInfo& newSt)
 
 	newSt.previous = st;
 	st = &newSt;
+	// ]l evaluate() Ă΂ꂽƂɍŋ߂
+	st->evalSum[0] = EVAL_SUM_NONE;
+	st->lastMove = m;
 
 	// Update side to move
 	key ^= zobSideToMove;
@@ -979,6 +919,9 @@ void Position::do_move(Move m, StateInfo& newSt)
 	prefetch(reinterpret_cast<char*>(TT.first_entry(key)));
 
 	// Move the piece
+	if (capture) toggle_bb(capture, to);
+	toggle_bb(ban[from], from);
+	toggle_bb(piece, to);
 
 	ban[to]   = piece;
 	ban[from] = EMP;
@@ -1204,6 +1147,7 @@ void Position::do_drop(Move m)
 	knpos[kn] = to;
 	ban[to] = piece;
 	komano[to] = kn;
+	toggle_bb(piece, to);
 
 	// XV
 	add_effect(to);
@@ -1360,6 +1304,8 @@ void Position::undo_move(Move m) {
 	knkind[kn] = piece;
 	knpos[kn] = from;
 
+	toggle_bb(ban[to], to);
+	toggle_bb(piece, from);
 	ban[to] = captured;
 	komano[from] = komano[to];
 	ban[from] = piece;
@@ -1427,6 +1373,7 @@ void Position::undo_move(Move m) {
 		knpos[kn] = to;
 		ban[to] = captured;
 		komano[to] = kn;
+		toggle_bb(captured, to);
 		add_effect(to);	// ̗ǉ
 
 		if (us == BLACK) handS.dec(captured & ~(GOTE | PROMOTED));
@@ -1623,6 +1570,7 @@ void Position::undo_drop(Move m)
 
 	knkind[kn] = piece;
 	knpos[kn] = (us == BLACK) ? 1 : 2;
+	toggle_bb(piece, to);
 	ban[to] = EMP;
 	komano[to] = 0;
 
@@ -2313,45 +2261,47 @@ MoveStack* Position::gen_drop_to(const Color us, MoveStack* mlist, int to) const
 	return mlist;
 }
 
+namespace {
+	// ڂ̏W target ̂ꂼɋł tmp ڂ̏ɐ
+	inline MoveStack* add_drops(MoveStack* mlist, const Bitboard81& target, const unsigned int tmp)
+	{
+		for (uint64_t b = target.p[0]; b; b &= b - 1) {
+			(mlist++)->move = Move(tmp | To2Move(bb81_square(Bitboard81::lsb(b))));
+		}
+		for (uint64_t b = target.p[1]; b; b &= b - 1) {
+			(mlist++)->move = Move(tmp | To2Move(bb81_square(Bitboard81::lsb(b) + 63)));
+		}
+		return mlist;
+	}
+}
+
 // ł̐
 template <Color us>
 MoveStack* Position::gen_drop(MoveStack* mlist) const
 {
-	int z;
-	int suji;
 	unsigned int tmp;
-	int StartDan;
 
 #if defined(DEBUG_GENERATE)
 	MoveStack* top = mlist;
 #endif
-///	int teNum = teNumM;	// AhXȂ
+	// 󂢂Ă}Xɑł
+	const Bitboard81 empty = ~occupiedBB;
+
 	// ł
 	uint32_t exists;
 	exists = (us == BLACK) ? handS.existFU() : handG.existFU();
 	if (exists > 0) {
 		tmp  = (us == BLACK) ? Piece2Move(SFU) : Piece2Move(GFU);	// From = 0;
+		// `FbNF̂̕Ȃ؂ɂłĂ
 		//(ȂQiڂ艺ɁAȂWiڂɑłj
-		StartDan = (us == BLACK) ? 2 : 1;
-		for (suji = 0x10; suji <= 0x90; suji += 0x10) {
-			// `FbN
-			if (is_double_pawn(us, suji)) continue;
-			z = suji + StartDan;
-			// łl߂`FbN
-#define FU_FUNC(z)	\
-	if (ban[z] == EMP && !is_pawn_drop_mate(us, z)) {	\
-		(mlist++)->move = Move(tmp | To2Move(z));	\
-	}
-			FU_FUNC(z  )
-			FU_FUNC(z+1)
-			FU_FUNC(z+2)
-			FU_FUNC(z+3)
-			FU_FUNC(z+4)
-			FU_FUNC(z+5)
-			FU_FUNC(z+6)
-			FU_FUNC(z+7)
-#undef FU_FUNC
+		Bitboard81 target = empty & files_bb81(~pawnFiles[us] & 0x1FF)
+		                  & ((us == BLACK) ? rank_bb81(2, 9) : rank_bb81(1, 8));
+		// łl߂`FbN(ʂ̓ɑł肾łl߂ɂȂ肤)
+		const int head = (us == BLACK) ? kingG + DIR_DOWN : kingS + DIR_UP;
+		if (ban[head] == EMP && target.is_set(bb81_index(head)) && is_pawn_drop_mate(us, head)) {
+			target.toggle(bb81_index(head));
 		}
+		mlist = add_drops(mlist, target, tmp);
 	}
 
 	// ł
@@ -2359,22 +2309,7 @@ MoveStack* Position::gen_drop(MoveStack* mlist) const
 	if (exists > 0) {
 		tmp  = (us == BLACK) ? Piece2Move(SKY) : Piece2Move(GKY); // From = 0
 		//(ȂQiڂ艺ɁAȂWiڂɑłj
-		z = (us == BLACK) ? 0x12 : 0x11;
-		for(; z <= 0x99; z += 0x10) {
-#define KY_FUNC(z)	\
-			if (ban[z] == EMP) {	\
-				(mlist++)->move = Move(tmp | To2Move(z));	\
-			}
-			KY_FUNC(z  )
-			KY_FUNC(z+1)
-			KY_FUNC(z+2)
-			KY_FUNC(z+3)
-			KY_FUNC(z+4)
-			KY_FUNC(z+5)
-			KY_FUNC(z+6)
-			KY_FUNC(z+7)
-#undef KY_FUNC
-		}
+		mlist = add_drops(mlist, empty & ((us == BLACK) ? rank_bb81(2, 9) : rank_bb81(1, 8)), tmp);
 	}
 
 	//jł
@@ -2382,24 +2317,11 @@ MoveStack* Position::gen_drop(MoveStack* mlist) const
 	if (exists > 0) {
 		//(ȂRiڂ艺ɁAȂViڂɑłj
 		tmp  = (us == BLACK) ? Piece2Move(SKE) : Piece2Move(GKE); // From = 0
-		z = (us == BLACK) ? 0x13 : 0x11;
-		for ( ; z <= 0x99; z += 0x10) {
-#define KE_FUNC(z)	\
-			if (ban[z] == EMP) {	\
-				(mlist++)->move = Move(tmp | To2Move(z));	\
-			}
-			KE_FUNC(z)
-			KE_FUNC(z+1)
-			KE_FUNC(z+2)
-			KE_FUNC(z+3)
-			KE_FUNC(z+4)
-			KE_FUNC(z+5)
-			KE_FUNC(z+6)
-#undef KE_FUNC
-		}
+		mlist = add_drops(mlist, empty & ((us == BLACK) ? rank_bb81(3, 9) : rank_bb81(1, 7)), tmp);
 	}
 
 	// `Ԃ́AǂɂłłĂ
+	// ŏ̋̎𐶐Ac̋͂̎̋uč
 	const uint32_t koma_start = (us == BLACK) ? SGI : GGI;
 	const uint32_t koma_end = (us == BLACK) ? SHI : GHI;
 	uint32_t a[4];
@@ -2407,24 +2329,22 @@ MoveStack* Position::gen_drop(MoveStack* mlist) const
 	a[1] = (us == BLACK) ? handS.existKI() : handG.existKI();
 	a[2] = (us == BLACK) ? handS.existKA() : handG.existKA();
 	a[3] = (us == BLACK) ? handS.existHI() : handG.existHI();
+	MoveStack* first = NULL;
+	unsigned int firstTmp = 0;
+	int n = 0;
 	for (uint32_t koma = koma_start, i = 0; koma <= koma_end; koma++, i++) {
 		if (a[i] > 0) {
 			tmp  = Piece2Move(koma); // From = 0
-			for (z = 0x11; z <= 0x99; z += 0x10) {
-#define GI_FUNC(z)	\
-				if (ban[z] == EMP) {	\
-					(mlist++)->move = Move(tmp | To2Move(z));	\
+			if (first == NULL) {
+				first = mlist;
+				firstTmp = tmp;
+				mlist = add_drops(mlist, empty, tmp);
+				n = int(mlist - first);
+			} else {
+				for (int k = 0; k < n; k++) {
+					mlist[k].move = Move(first[k].move ^ firstTmp ^ tmp);
 				}
-				GI_FUNC(z)
-				GI_FUNC(z+1)
-				GI_FUNC(z+2)
-				GI_FUNC(z+3)
-				GI_FUNC(z+4)
-				GI_FUNC(z+5)
-				GI_FUNC(z+6)
-				GI_FUNC(z+7)
-				GI_FUNC(z+8)
-#undef GI_FUNC
+				mlist += n;
 			}
 		}
 	}
@@ -20,15 +20,67 @@
 
 #include <iostream>
 
+#include "misc.h"
 #include "thread.h"
+#include "tt.h"
 #include "ucioption.h"
 
 ThreadsManager Threads; // Global object definition
 
 namespace
 {
+// A chunk of memory to be zeroed by a helper thread of clear_memory()
+struct ClearChunk {
+	char* begin;
+	size_t size;
+};
+
 extern "C" {
 
+// clear_routine() is the thread function of clear_memory() helpers.
+
+#if defined(_MSC_VER) || defined(_WIN32)
+
+DWORD WINAPI clear_routine(LPVOID chunk)
+{
+
+	memset(((ClearChunk *)chunk)->begin, 0, ((ClearChunk *)chunk)->size);
+	return 0;
+}
+
+#else
+
+void *clear_routine(void *chunk)
+{
+
+	memset(((ClearChunk *)chunk)->begin, 0, ((ClearChunk *)chunk)->size);
+	return NULL;
+}
+
+#endif
+
+// task_routine() is the thread function of ThreadsManager::start_task().
+
+#if defined(_MSC_VER) || defined(_WIN32)
+
+DWORD WINAPI task_routine(LPVOID task)
+{
+
+	((BackgroundTask *)task)->run();
+	return 0;
+}
+
+#else
+
+void *task_routine(void *task)
+{
+
+	((BackgroundTask *)task)->run();
+	return NULL;
+}
+
+#endif
+
 // start_routine() is the C function which is called when a new thread
 // is launched. It simply calls idle_loop() of the supplied thread.
 // There are two versions of this function; one for POSIX threads and
@@ -39,6 +91,9 @@ extern "C" {
 DWORD WINAPI start_routine(LPVOID thread)
 {
 
+#if defined(CHK_PERFORM)
+	TTPerform::threadIdx = ((Thread *)thread)->threadID;
+#endif
 	((Thread *)thread)->idle_loop(NULL);
 	return 0;
 }
@@ -48,6 +103,9 @@ DWORD WINAPI start_routine(LPVOID thread)
 void *start_routine(void *thread)
 {
 
+#if defined(CHK_PERFORM)
+	TTPerform::threadIdx = ((Thread *)thread)->threadID;
+#endif
 	((Thread *)thread)->idle_loop(NULL);
 	return NULL;
 }
@@ -116,6 +174,14 @@ void ThreadsManager::read_uci_options()
 	useSleepingThreads = Options["Use Sleeping Threads"].value<bool>();
 
 	set_size(Options["Threads"].value<int>());
+
+#if defined(NANOHA)
+	for (int i = 0; i < activeThreads; i++)
+	{
+		threads[i].evalCache.set_size(Options["EvalCache"].value<int>());
+		threads[i].evalCache.reset_stats();
+	}
+#endif
 }
 
 // set_size() changes the number of active threads and raises do_sleep flag for
@@ -367,3 +433,107 @@ Value ThreadsManager::split(Position &pos, SearchStack *ss, Value alpha, Value b
 // Explicit template instantiations
 template Value ThreadsManager::split<false>(Position &, SearchStack *, Value, Value, Value, Depth, Move, int, MovePicker *, int);
 template Value ThreadsManager::split<true>(Position &, SearchStack *, Value, Value, Value, Depth, Move, int, MovePicker *, int);
+
+// clear_memory() zeroes a large block of memory, like the transposition table.
+// The block is split in one chunk per cpu and each chunk but the first is
+// cleared by a short lived helper thread, so that a multi-gigabyte table is
+// cleared in a fraction of the time of a single memset(). On NUMA machines this
+// also spreads the first touch of the pages over the cpus.
+
+void ThreadsManager::clear_memory(void* mem, size_t size)
+{
+
+	const size_t MinChunkSize = 16 * 1024 * 1024;
+	int cnt = cpu_count();
+
+	if (size / MinChunkSize < size_t(cnt))
+		cnt = int(size / MinChunkSize);
+
+	if (cnt <= 1) {
+		memset(mem, 0, size);
+		return;
+	}
+
+	// Round chunks to 4KB pages so that no page is shared by two threads
+	const size_t chunkSize = (size / cnt + 4095) & ~size_t(4095);
+	ClearChunk chunks[MAX_THREADS];
+#if defined(_MSC_VER) || defined(_WIN32)
+	HANDLE handles[MAX_THREADS];
+#else
+	pthread_t handles[MAX_THREADS];
+#endif
+	bool started[MAX_THREADS];
+
+	for (int i = 0; i < cnt; i++) {
+		size_t begin = Min(chunkSize * i, size);
+		chunks[i].begin = (char *)mem + begin;
+		chunks[i].size = Min(chunkSize, size - begin);
+	}
+
+	for (int i = 1; i < cnt; i++) {
+#if defined(_MSC_VER) || defined(_WIN32)
+		handles[i] = CreateThread(NULL, 0, clear_routine, (LPVOID)&chunks[i], 0, NULL);
+		started[i] = (handles[i] != NULL);
+#else
+		started[i] = (pthread_create(&handles[i], NULL, clear_routine, (void *)&chunks[i]) == 0);
+#endif
+	}
+
+	// The calling thread clears the first chunk and the chunks of any helper
+	// that could not be launched.
+	for (int i = 0; i < cnt; i++)
+		if (i == 0 || !started[i])
+			memset(chunks[i].begin, 0, chunks[i].size);
+
+	for (int i = 1; i < cnt; i++)
+		if (started[i]) {
+#if defined(_MSC_VER) || defined(_WIN32)
+			WaitForSingleObject(handles[i], INFINITE);
+			CloseHandle(handles[i]);
+#else
+			pthread_join(handles[i], NULL);
+#endif
+		}
+}
+
+// start_task() runs 'task' in a new helper thread, so that a slow initialisation
+// overlaps with the start of the USI handshake. The task is run at once by the
+// calling thread if no helper can be launched. wait_for_tasks() must be called
+// before anything initialised by the task is used.
+
+void ThreadsManager::start_task(void (*task)())
+{
+
+	assert(taskCount < MAX_BACKGROUND_TASKS);
+
+	BackgroundTask& t = tasks[taskCount++];
+	t.run = task;
+#if defined(_MSC_VER) || defined(_WIN32)
+	t.handle = CreateThread(NULL, 0, task_routine, (LPVOID)&t, 0, NULL);
+	t.started = (t.handle != NULL);
+#else
+	t.started = (pthread_create(&t.handle, NULL, task_routine, (void *)&t) == 0);
+#endif
+
+	if (!t.started)
+		task();
+}
+
+// wait_for_tasks() blocks until all the tasks started by start_task() are done.
+// Only the thread that started them may call it.
+
+void ThreadsManager::wait_for_tasks()
+{
+
+	for (int i = 0; i < taskCount; i++)
+		if (tasks[i].started) {
+#if defined(_MSC_VER) || defined(_WIN32)
+			WaitForSingleObject(tasks[i].handle, INFINITE);
+			CloseHandle(tasks[i].handle);
+#else
+			pthread_join(tasks[i].handle, NULL);
+#endif
+		}
+
+	taskCount = 0;
+}
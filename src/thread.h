@@ -32,6 +32,9 @@
 #include "pawns.h"
 #endif
 #include "position.h"
+#if defined(NANOHA)
+#include "tt.h"
+#endif
 
 #if defined(NANOHA)
 const int MAX_THREADS = 4;
@@ -83,6 +86,8 @@ struct Thread {
 #if !defined(NANOHA)
 	MaterialInfoTable materialTable;
 	PawnInfoTable pawnTable;
+#else
+	EvalCache evalCache;
 #endif
 	int threadID;
 	int maxPly;
@@ -102,6 +107,22 @@ struct Thread {
 };
 
 
+/// BackgroundTask is a function run once by a short lived helper thread, like
+/// the slow initialisations started at launch (see ThreadsManager::start_task()).
+
+struct BackgroundTask {
+	void (*run)();
+	bool started;
+#if defined(_MSC_VER) || defined(_WIN32)
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+};
+
+const int MAX_BACKGROUND_TASKS = 4;
+
+
 /// ThreadsManager class is used to handle all the threads related stuff like init,
 /// starting, parking and, the most important, launching a slave thread at a split
 /// point. All the access to shared thread data is done through this class.
@@ -123,6 +144,9 @@ public:
 	void set_size(int cnt);
 	void read_uci_options();
 	bool available_slave_exists(int master) const;
+	void clear_memory(void* mem, size_t size);
+	void start_task(void (*task)());
+	void wait_for_tasks();
 
 	template <bool Fake>
 	Value split(Position& pos, SearchStack* ss, Value alpha, Value beta, Value bestValue,
@@ -134,6 +158,8 @@ private:
 	int maxThreadsPerSplitPoint;
 	int activeThreads;
 	bool useSleepingThreads;
+	BackgroundTask tasks[MAX_BACKGROUND_TASKS];
+	int taskCount;
 };
 
 extern ThreadsManager Threads;
@@ -18,52 +18,313 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "position.h"
+#include "thread.h"
 #include "tt.h"
+#include "ucioption.h"
 
 TranspositionTable TT; // Our global transposition table
 
+#if defined(CHK_PERFORM)
+// パフォーマンス計測用.
+namespace TTPerform {
+TT_THREAD_LOCAL int threadIdx;
+Counters counters[MAX_THREADS];
+}
+#endif
+
+namespace {
+
+#if defined(__linux__)
+	// Transparent and explicit huge pages are 2MB on x86-64
+	const size_t HugePageSize = 2 * 1024 * 1024;
+
+	// interleave_numa() asks the kernel to spread the pages of the given
+	// mapping round robin over all the online NUMA nodes. It must be called
+	// before the pages are touched for the first time. Nothing is done on a
+	// machine with a single node.
+	void interleave_numa(void* addr, size_t len) {
+
+		std::ifstream f("/sys/devices/system/node/online");
+		unsigned long mask = 0;
+		int first, last, nodes = 0;
+		char sep;
+
+		// The file holds a list of node ranges like "0-3" or "0,2-3"
+		while (f >> first)
+		{
+			last = first;
+			if (f.peek() == '-')
+				f >> sep >> last;
+			for (int n = first; n <= last && n < 64; n++, nodes++)
+				mask |= 1UL << n;
+			if (f.peek() == ',')
+				f >> sep;
+		}
+
+		const int MPOL_INTERLEAVE_ = 3;
+		if (nodes > 1)
+			syscall(SYS_mbind, addr, len, MPOL_INTERLEAVE_, &mask, 64, 0);
+	}
+#endif
+
+	// alloc_table() allocates memory for the table. On Linux the memory is
+	// mapped with mmap(), using explicit huge pages when they are reserved and
+	// the "LargePages" option is set, or transparent huge pages otherwise. Huge
+	// pages avoid most of the TLB misses of the random accesses to the table.
+	// Elsewhere we fall back to malloc(). 'mapped' tells how to release it.
+	void* alloc_table(size_t bytes, size_t& allocSize, bool& mapped) {
+
+#if defined(__linux__)
+		allocSize = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+
+		void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+		if (Options["LargePages"].value<bool>())
+			p = mmap(NULL, allocSize, PROT_READ | PROT_WRITE,
+			         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (p == MAP_FAILED)
+		{
+			p = mmap(NULL, allocSize, PROT_READ | PROT_WRITE,
+			         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+			if (p != MAP_FAILED)
+				madvise(p, allocSize, MADV_HUGEPAGE);
+#endif
+		}
+
+		if (p != MAP_FAILED)
+		{
+			if (Options["NumaInterleave"].value<bool>())
+				interleave_numa(p, allocSize);
+
+			mapped = true;
+			return p;
+		}
+#endif
+		// Allocate one extra cache line so that the clusters can be aligned on
+		// a cache line boundary, whatever the alignment malloc() gives us.
+		allocSize = bytes + 63;
+		mapped = false;
+		return malloc(allocSize);
+	}
+
+	// Header of a table snapshot written by save(). It is 64 bytes long, so
+	// that the clusters that follow it stay aligned on a cache line when the
+	// file is mapped in memory.
+	struct TTFileHeader {
+		char magic[8];         // "NANOTT1"
+		uint32_t clusterBytes; // sizeof(TTCluster), rejects other entry formats
+		uint32_t generation;
+		uint64_t clusters;
+		uint32_t bucketSize;   // 0 in files written before buckets were configurable
+		char reserved[36];
+	};
+
+	const char TTFileMagic[8] = "NANOTT1";
+
+	// bucket_shift() returns log2 of the bucket width, rounded down to a power
+	// of two between 2 and 16 entries.
+	int bucket_shift(int width) {
+
+		int shift = 1;
+		while (shift < 4 && (2 << shift) <= width)
+			shift++;
+		return shift;
+	}
+
+#if defined(__linux__)
+	// attach_shared() maps the named POSIX shared memory segment 'name', so that
+	// several engine processes on the same host can share one table. The segment
+	// is created with the requested size if it does not exist yet, and 'fresh'
+	// tells the caller that it has to be cleared. An existing segment of another
+	// size is not resized under the feet of the processes using it: NULL is
+	// returned instead. The segment outlives the processes, remove it from
+	// /dev/shm to release the memory.
+	void* attach_shared(std::string name, size_t bytes, size_t& allocSize, bool& fresh) {
+
+		if (name.empty() || name[0] != '/')
+			name = "/" + name;
+
+		allocSize = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+
+		int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+		if (fd < 0)
+			return NULL;
+
+		struct stat st;
+		void* p = MAP_FAILED;
+
+		if (fstat(fd, &st) == 0 && (st.st_size == 0 || uint64_t(st.st_size) == allocSize))
+		{
+			fresh = (st.st_size == 0);
+			if (!fresh || ftruncate(fd, off_t(allocSize)) == 0)
+				p = mmap(NULL, allocSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+
+		if (p == MAP_FAILED)
+			return NULL;
+
+#if defined(MADV_HUGEPAGE)
+		madvise(p, allocSize, MADV_HUGEPAGE);
+#endif
+		return p;
+	}
+#endif
+
+	void free_table(void* p, size_t allocSize, bool mapped) {
+
+#if defined(__linux__)
+		if (mapped)
+		{
+			munmap(p, allocSize);
+			return;
+		}
+#endif
+		(void)allocSize;
+		(void)mapped;
+		free(p);
+	}
+}
+
 TranspositionTable::TranspositionTable() {
 
 	size = generation = 0;
+	buckets = 0;
+	bucketShift = 2;
+	set_replacement(REPLACE_DEFAULT, ClusterSize);
 	entries = NULL;
+	mem = NULL;
+	memSize = 0;
+	memMapped = memShared = false;
 }
 
 TranspositionTable::~TranspositionTable() {
 
-	delete [] entries;
+	if (mem)
+		free_table(mem, memSize, memMapped);
 }
 
 
+#if defined(NANOHA)
+/// TTEntry::move() rebuilds the full 32 bits move from the packed one. The
+/// moving piece and the captured piece are read from the board. Moves that can
+/// not come from this position (no own piece on the origin square, impossible
+/// promotion) are rejected here, because the board lookup would otherwise make
+/// them look consistent. The result must still be validated with
+/// is_pseudo_legal() like any other hash move.
+
+Move TTEntry::move(const Position& pos) const {
+
+	const int move16 = packed_move();
+	if (move16 == 0)
+		return MOVE_NONE;
+
+	const Color us = pos.side_to_move();
+	const int to = conv_sq2z(move16 & 0x7F);
+	const int from = (move16 >> 7) & 0x7F;
+	const int promote = (move16 >> 14) & 1;
+
+	if (from >= 81)
+	{
+		const int pt = from - 81 + 1;
+		if (pt > HI || promote)
+			return MOVE_NONE;
+		return cons_move(0, to, Piece(us == BLACK ? pt : pt | GOTE), EMP);
+	}
+
+	const int fromZ = conv_sq2z(from);
+	const Piece piece = pos.piece_on(Square(fromZ));
+	if (piece == EMP || color_of(piece) != us)
+		return MOVE_NONE;
+
+	if (promote)
+	{
+		const PieceType pt = type_of(piece);
+		if (pt == KI || (pt & PROMOTED))
+			return MOVE_NONE;
+		const bool zone = (us == BLACK) ? ((to & 0x0F) <= 3 || (fromZ & 0x0F) <= 3)
+		                                : ((to & 0x0F) >= 7 || (fromZ & 0x0F) >= 7);
+		if (!zone)
+			return MOVE_NONE;
+	}
+
+	return cons_move(fromZ, to, piece, pos.piece_on(Square(to)), promote);
+}
+#endif
+
+
 /// TranspositionTable::set_size() sets the size of the transposition table,
-/// measured in megabytes.
+/// measured in megabytes. Any size is accepted, the whole amount is used.
 
 void TranspositionTable::set_size(size_t mbSize) {
 
-	size_t newSize = 1024;
-
 	// Transposition table consists of clusters and each cluster consists
 	// of ClusterSize number of TTEntries. Each non-empty entry contains
 	// information of exactly one position and newSize is the number of
-	// clusters we are going to allocate.
-	while (2ULL * newSize * sizeof(TTCluster) <= (mbSize << 20))
-		newSize *= 2;
+	// clusters we are going to allocate. first_entry() indexes with 32 bits
+	// of the key, so no more than 2^32 clusters can be addressed.
+	uint64_t newSize = (uint64_t(mbSize) << 20) / sizeof(TTCluster);
+
+	if (newSize < 1024)
+		newSize = 1024;
+	if (newSize > (UINT64_C(1) << 32))
+		newSize = (UINT64_C(1) << 32);
+
+	const bool shared = Options["SharedHash"].value<bool>();
 
-	if (newSize == size)
+	if (newSize == size && shared == memShared)
 		return;
 
-	size = newSize;
-	delete [] entries;
-	entries = new (std::nothrow) TTCluster[size];
-	if (!entries)
+	size = size_t(newSize);
+	if (mem)
+		free_table(mem, memSize, memMapped);
+
+	bool fresh = true;
+	mem = NULL;
+
+#if defined(__linux__)
+	if (shared)
+	{
+		mem = attach_shared(Options["SharedHashName"].value<std::string>(),
+		                    size * sizeof(TTCluster), memSize, fresh);
+		if (!mem)
+			std::cerr << "Failed to attach shared hash " << Options["SharedHashName"].value<std::string>()
+			          << ", using a private transposition table." << std::endl;
+	}
+#endif
+	memShared = (mem != NULL);
+	memMapped = memShared;
+
+	if (!mem)
+		mem = alloc_table(size * sizeof(TTCluster), memSize, memMapped);
+	if (!mem)
 	{
 		std::cerr << "Failed to allocate " << mbSize
 		          << "MB for transposition table." << std::endl;
 		exit(EXIT_FAILURE);
 	}
-	clear();
+	entries = reinterpret_cast<TTCluster*>((uintptr_t(mem) + 63) & ~uintptr_t(63));
+	set_buckets();
+
+	// Don't wipe a shared table that other processes are already filling
+	if (fresh)
+		clear();
 }
 
 
@@ -73,87 +334,192 @@ void TranspositionTable::set_size(size_t mbSize) {
 
 void TranspositionTable::clear() {
 
-	memset(entries, 0, size * sizeof(TTCluster));
+	Threads.clear_memory(entries, size * sizeof(TTCluster));
+}
+
+
+namespace {
+
+	// Replace<P>::victim() returns the entry of the full bucket starting at
+	// 'first' that is overwritten by a new entry of depth 'd'.
+	template<ReplacePolicy P>
+	struct Replace {
+		static TTEntry* victim(TTEntry* first, int width, Depth d, int generation);
+	};
+
+	// The replace strategy of Stockfish: an entry of an older search or of a
+	// smaller depth goes first, EXACT entries are kept when possible.
+	template<>
+	TTEntry* Replace<REPLACE_DEFAULT>::victim(TTEntry* first, int width, Depth, int generation) {
+
+		TTEntry* replace = first;
+
+		for (TTEntry* tte = first + 1; tte < first + width; tte++)
+		{
+			int c1 = (replace->generation() == generation ?  2 : 0);
+			int c2 = (tte->generation() == generation || tte->type() == VALUE_TYPE_EXACT ? -2 : 0);
+			int c3 = (tte->depth() < replace->depth() ?  1 : 0);
+
+			if (c1 + c2 + c3 > 0)
+				replace = tte;
+		}
+		return replace;
+	}
+
+	// Two tiers: all the slots but the last one keep the deepest entries, the
+	// last one takes whatever the depth-preferred slots refuse.
+	template<>
+	TTEntry* Replace<REPLACE_TWO_TIER>::victim(TTEntry* first, int width, Depth d, int generation) {
+
+		TTEntry* replace = first;
+
+		for (TTEntry* tte = first + 1; tte < first + width - 1; tte++)
+			if (   (tte->generation() != generation && replace->generation() == generation)
+			    || (   (tte->generation() == generation) == (replace->generation() == generation)
+			        && tte->depth() < replace->depth()))
+				replace = tte;
+
+		if (replace->generation() != generation || d >= replace->depth())
+			return replace;
+
+		return first + width - 1;
+	}
+
+	// The smallest depth wins, each search the entry has survived counting
+	// as 8 plies less.
+	template<>
+	TTEntry* Replace<REPLACE_AGE_DEPTH>::victim(TTEntry* first, int width, Depth, int generation) {
+
+		TTEntry* replace = first;
+		int worst = INT_MAX;
+
+		for (TTEntry* tte = first; tte < first + width; tte++)
+		{
+			int score = int(tte->depth()) - 8 * int(ONE_PLY) * ((generation - tte->generation()) & 0xFF);
+			if (score < worst)
+			{
+				worst = score;
+				replace = tte;
+			}
+		}
+		return replace;
+	}
 }
 
 
 /// TranspositionTable::store() writes a new entry containing position key and
 /// valuable information of current position. The lowest order bits of position
-/// key are used to decide on which cluster the position will be placed.
-/// When a new entry is written and there are no empty entries available in cluster,
-/// it replaces the least valuable of entries. A TTEntry t1 is considered to be
-/// more valuable than a TTEntry t2 if t1 is from the current search and t2 is from
-/// a previous search, or if the depth of t1 is bigger than the depth of t2.
+/// key are used to decide on which bucket the position will be placed.
+/// When a new entry is written and there are no empty entries available in bucket,
+/// it replaces the least valuable of entries, as decided by the replacement
+/// policy P (see Replace<P>::victim()).
 
 #if defined(NANOHA)
-void TranspositionTable::store(const Key posKey, uint32_t h, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
+template<ReplacePolicy P>
+void TranspositionTable::do_store(const Key posKey, uint32_t h, Value v, ValueType t, Depth d, Move m, Value statV, Value) {
 #else
-void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
+template<ReplacePolicy P>
+void TranspositionTable::do_store(const Key posKey, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
 #endif
-	int c1, c2, c3;
-	TTEntry *tte, *replace;
-#if defined(NANOHA)
-	uint64_t posKey48 = (posKey & ~UINT64_C(0xFFFF)); // Use the high 48 bits as key inside the cluster
-#else
+	TTEntry *tte, *first, *replace;
 	uint32_t posKey32 = posKey >> 32; // Use the high 32 bits as key inside the cluster
+	const int width = bucket_size();
+#if defined(NANOHA)
+	uint16_t m16 = TTEntry::pack_move(m);
 #endif
 
-	tte = replace = first_entry(posKey);
+	tte = first = first_entry(posKey);
 
-	for (int i = 0; i < ClusterSize; i++, tte++)
+	for (int i = 0; i < width; i++, tte++)
 	{
 #if defined(NANOHA)
-		if (!tte->key() || (tte->key() == posKey48 && tte->hand() == h)) // Empty or overwrite old
+		if (!tte->key() || (tte->key() == posKey32 && tte->hand() == h)) // Empty or overwrite old
 #else
 		if (!tte->key() || tte->key() == posKey32) // Empty or overwrite old
 #endif
 		{
+#if defined(NANOHA)
+			COUNT_PERFORM(tte->key() ? TT_COUNTERS.sameKey : TT_COUNTERS.empty);
+
+			// Preserve any existing ttMove
+			tte->save(posKey, h, v, t, d, m16 ? m16 : tte->packed_move(), generation, statV);
+#else
 			// Preserve any existing ttMove
 			if (m == MOVE_NONE)
 				m = tte->move();
 
-#if defined(NANOHA)
-			tte->save(posKey48, h, v, t, d, m, generation, statV, kingD);
-#else
 			tte->save(posKey32, v, t, d, m, generation, statV, kingD);
 #endif
 			return;
 		}
-
-		// Implement replace strategy
-		c1 = (replace->generation() == generation ?  2 : 0);
-		c2 = (tte->generation() == generation || tte->type() == VALUE_TYPE_EXACT ? -2 : 0);
-		c3 = (tte->depth() < replace->depth() ?  1 : 0);
-
-		if (c1 + c2 + c3 > 0)
-			replace = tte;
 	}
+
+	replace = Replace<P>::victim(first, width, d, generation);
 #if defined(NANOHA)
-	replace->save(posKey48, h, v, t, d, m, generation, statV, kingD);
+	COUNT_PERFORM(replace->generation() == generation ? TT_COUNTERS.replaceCurrent : TT_COUNTERS.replaceOld);
+	replace->save(posKey, h, v, t, d, m16, generation, statV);
 #else
 	replace->save(posKey32, v, t, d, m, generation, statV, kingD);
 #endif
 }
 
 
+/// TranspositionTable::set_replacement() selects the replacement policy and
+/// the number of entries of a bucket, rounded down to a power of two between
+/// 2 and 16. Changing the bucket width moves every position to another
+/// bucket, so the table is cleared in that case.
+
+void TranspositionTable::set_replacement(int p, int width) {
+
+	static const StoreFn StoreFns[REPLACE_POLICY_NB] = {
+		&TranspositionTable::do_store<REPLACE_DEFAULT>,
+		&TranspositionTable::do_store<REPLACE_TWO_TIER>,
+		&TranspositionTable::do_store<REPLACE_AGE_DEPTH>
+	};
+
+	policy = ReplacePolicy(p >= 0 && p < REPLACE_POLICY_NB ? p : REPLACE_DEFAULT);
+	storeFn = StoreFns[policy];
+
+	const int shift = bucket_shift(width);
+
+	if (shift == bucketShift)
+		return;
+
+	bucketShift = shift;
+	set_buckets();
+	if (entries)
+		clear();
+}
+
+
 /// TranspositionTable::probe() looks up the current position in the
 /// transposition table. Returns a pointer to the TTEntry or NULL if
 /// position is not found.
 
 #if defined(NANOHA)
-TTEntry* TranspositionTable::probe(const Key posKey, uint32_t h) const {
-	uint64_t posKey48 = (posKey & ~UINT64_C(0xFFFF));
-	TTEntry* tte = first_entry(posKey);
+const TTEntry* TranspositionTable::probe(const Key posKey, uint32_t h, TTEntry& copy) const {
+	uint32_t posKey32 = posKey >> 32;
+	const TTEntry* tte = first_entry(posKey);
 
-	for (int i = 0; i < ClusterSize; i++, tte++)
-		if (tte->key() == posKey48 && tte->hand() == h)
-			return tte;
+	COUNT_PERFORM(TT_COUNTERS.probes);
+
+	// Check the copy, not the slot, so that a concurrent store cannot change
+	// the entry between the key check and the use of its fields.
+	for (int i = 0; i < bucket_size(); i++, tte++)
+	{
+		copy = *tte;
+		if (copy.key() == posKey32 && copy.hand() == h)
+		{
+			COUNT_PERFORM(TT_COUNTERS.hits);
+			return &copy;
+		}
+	}
 #else
 TTEntry* TranspositionTable::probe(const Key posKey) const {
 	uint32_t posKey32 = posKey >> 32;
 	TTEntry* tte = first_entry(posKey);
 
-	for (int i = 0; i < ClusterSize; i++, tte++)
+	for (int i = 0; i < bucket_size(); i++, tte++)
 		if (tte->key() == posKey32)
 			return tte;
 #endif
@@ -162,6 +528,47 @@ TTEntry* TranspositionTable::probe(const Key posKey) const {
 }
 
 
+#if defined(NANOHA)
+/// TranspositionTable::probe_dominance() is used when probe() misses. It looks
+/// in the cluster for an entry of the same board whose hand differs from the
+/// current hand 'h' but can be compared with it. The hand of the side to move
+/// decides the hand of the opponent, so holding more pieces in hand is never
+/// worse. If the current hand dominates the stored one, the stored value is
+/// still a lower bound; if it is dominated, the stored value is still an upper
+/// bound. The returned copy has its value type reduced to the bound that still
+/// holds, so can_return_tt() and friends can use it as is. The static value of
+/// such an entry belongs to another position and must not be used.
+
+const TTEntry* TranspositionTable::probe_dominance(const Key posKey, uint32_t h, TTEntry& copy) const {
+	uint32_t posKey32 = posKey >> 32;
+	const TTEntry* tte = first_entry(posKey);
+
+	for (int i = 0; i < bucket_size(); i++, tte++)
+	{
+		copy = *tte;
+		if (copy.key() != posKey32 || copy.hand() == h)
+			continue;
+
+		int t;
+		if (IS_DOM_HAND(h, copy.hand()))
+			t = copy.type() & VALUE_TYPE_LOWER;
+		else if (IS_DOM_HAND(copy.hand(), h))
+			t = copy.type() & VALUE_TYPE_UPPER;
+		else
+			continue;
+
+		if (t != VALUE_TYPE_NONE)
+		{
+			COUNT_PERFORM(TT_COUNTERS.dominanceHits);
+			copy.set_type(ValueType(t));
+			return &copy;
+		}
+	}
+	return NULL;
+}
+#endif
+
+
 /// TranspositionTable::new_search() is called at the beginning of every new
 /// search. It increments the "generation" variable, which is used to
 /// distinguish transposition table entries from previous searches from
@@ -170,3 +577,251 @@ TTEntry* TranspositionTable::probe(const Key posKey) const {
 void TranspositionTable::new_search() {
 	generation++;
 }
+
+
+/// TranspositionTable::hashfull() returns the permill of the table used by
+/// the current search. Only the first 1000 entries are looked at, which is
+/// cheap enough to be done for every info line.
+
+int TranspositionTable::hashfull() const {
+
+	if (!entries)
+		return 0;
+
+	int cnt = 0;
+	const int clusters = int(Min(size, size_t(1000 / ClusterSize)));
+
+	for (int i = 0; i < clusters; i++)
+		for (int j = 0; j < ClusterSize; j++)
+			if (entries[i].data[j].key() && entries[i].data[j].generation() == generation)
+				cnt++;
+
+	return cnt * 1000 / (clusters * ClusterSize);
+}
+
+
+/// TranspositionTable::print_stats() prints the occupancy of the whole table
+/// and, with CHK_PERFORM, the probe and store counters summed over all the
+/// threads since the last reset. It is called by the "ttstats" command.
+
+void TranspositionTable::print_stats(std::ostream& os) const {
+
+	uint64_t used = 0, current = 0;
+
+	for (size_t i = 0; i < size; i++)
+		for (int j = 0; j < ClusterSize; j++)
+			if (entries[i].data[j].key())
+			{
+				used++;
+				if (entries[i].data[j].generation() == generation)
+					current++;
+			}
+
+	const double total = double(size) * ClusterSize;
+
+	os << "\n==============================="
+	   << "\n TT size(MB)     : " << size_mb()
+	   << "\n entries         : " << uint64_t(total)
+	   << "\n used(%)         : " << (total > 0 ? used * 100.0 / total : 0.0)
+	   << "\n this search(%)  : " << (total > 0 ? current * 100.0 / total : 0.0)
+	   << "\n hashfull        : " << hashfull();
+
+#if defined(CHK_PERFORM)
+	TTPerform::Counters sum;
+	memset(&sum, 0, sizeof(sum));
+
+	for (int i = 0; i < MAX_THREADS; i++)
+	{
+		const TTPerform::Counters& c = TTPerform::counters[i];
+		sum.probes += c.probes;
+		sum.hits += c.hits;
+		sum.dominanceHits += c.dominanceHits;
+		sum.empty += c.empty;
+		sum.sameKey += c.sameKey;
+		sum.replaceOld += c.replaceOld;
+		sum.replaceCurrent += c.replaceCurrent;
+	}
+
+	const uint64_t stores = sum.empty + sum.sameKey + sum.replaceOld + sum.replaceCurrent;
+
+	os << "\n probes          : " << sum.probes;
+	if (sum.probes > 0)
+		os << "\n hit(%)          : " << sum.hits * 100.0 / sum.probes
+		   << "\n miss(%)         : " << (sum.probes - sum.hits) * 100.0 / sum.probes
+		   << "\n dominance hits  : " << sum.dominanceHits;
+	os << "\n stores          : " << stores;
+	if (stores > 0)
+		os << "\n empty slot(%)   : " << sum.empty * 100.0 / stores
+		   << "\n same key(%)     : " << sum.sameKey * 100.0 / stores
+		   << "\n old gen(%)      : " << sum.replaceOld * 100.0 / stores
+		   << "\n current gen(%)  : " << sum.replaceCurrent * 100.0 / stores;
+#endif
+	os << std::endl;
+}
+
+
+#if defined(CHK_PERFORM)
+void TTPerform::reset() {
+
+	memset(counters, 0, sizeof(counters));
+}
+#endif
+
+
+/// TranspositionTable::save() writes the whole table to a file, preceded by a
+/// TTFileHeader holding the generation and the number of clusters, so that a
+/// long analysis can be resumed later with load(). Returns false on error.
+
+bool TranspositionTable::save(const std::string& fname) const {
+
+	if (!entries)
+		return false;
+
+	FILE* fp = fopen(fname.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	TTFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TTFileMagic, sizeof(header.magic));
+	header.clusterBytes = sizeof(TTCluster);
+	header.generation = generation;
+	header.clusters = size;
+	header.bucketSize = bucket_size();
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+	// Write in chunks, a single fwrite() of several GB is not portable
+	const size_t Chunk = 1024 * 1024;
+	for (size_t i = 0; ok && i < size; i += Chunk)
+		ok = fwrite(entries + i, sizeof(TTCluster), Min(Chunk, size - i), fp) == Min(Chunk, size - i);
+
+	return (fclose(fp) == 0) && ok;
+}
+
+
+/// TranspositionTable::load() replaces the table by a snapshot written by
+/// save(). The size of the table becomes the one of the snapshot. On Linux
+/// the file is mapped copy-on-write, so a multi-gigabyte table is ready at
+/// once and its pages are only read from disk when the search touches them.
+/// Returns false, leaving the table unchanged, if the file is not a valid
+/// snapshot.
+
+bool TranspositionTable::load(const std::string& fname) {
+
+	FILE* fp = fopen(fname.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	TTFileHeader header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1
+	       && !memcmp(header.magic, TTFileMagic, sizeof(header.magic))
+	       && header.clusterBytes == sizeof(TTCluster)
+	       && header.clusters >= 1024
+	       && header.clusters <= (UINT64_C(1) << 32)
+	       && header.clusters <= (~size_t(0) - sizeof(header)) / sizeof(TTCluster);
+
+	const size_t bytes = ok ? size_t(header.clusters) * sizeof(TTCluster) : 0;
+
+#if defined(__linux__)
+	struct stat st;
+	ok = ok && fstat(fileno(fp), &st) == 0 && uint64_t(st.st_size) == sizeof(header) + uint64_t(bytes);
+
+	void* p = ok ? mmap(NULL, sizeof(header) + bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0)
+	             : MAP_FAILED;
+	fclose(fp);
+
+	if (p == MAP_FAILED)
+		return false;
+
+	// The search accesses the table at random, so don't read ahead
+	madvise(p, sizeof(header) + bytes, MADV_RANDOM);
+
+	if (mem)
+		free_table(mem, memSize, memMapped);
+
+	mem = p;
+	memSize = sizeof(header) + bytes;
+	memMapped = true;
+	entries = reinterpret_cast<TTCluster*>(static_cast<char*>(p) + sizeof(header));
+#else
+	size_t allocSize = 0;
+	bool mapped = false;
+	void* p = ok ? alloc_table(bytes, allocSize, mapped) : NULL;
+	TTCluster* clusters = reinterpret_cast<TTCluster*>((uintptr_t(p) + 63) & ~uintptr_t(63));
+
+	const size_t Chunk = 1024 * 1024;
+	for (size_t i = 0; p && i < size_t(header.clusters); i += Chunk)
+		if (fread(clusters + i, sizeof(TTCluster), Min(Chunk, size_t(header.clusters) - i), fp) != Min(Chunk, size_t(header.clusters) - i))
+		{
+			free_table(p, allocSize, mapped);
+			p = NULL;
+		}
+	fclose(fp);
+
+	if (!p)
+		return false;
+
+	if (mem)
+		free_table(mem, memSize, memMapped);
+
+	mem = p;
+	memSize = allocSize;
+	memMapped = mapped;
+	entries = clusters;
+#endif
+
+	size = size_t(header.clusters);
+	generation = uint8_t(header.generation);
+	memShared = false;
+
+	// Positions must be looked up in the buckets they were saved in
+	bucketShift = bucket_shift(header.bucketSize ? int(header.bucketSize) : ClusterSize);
+	set_buckets();
+	return true;
+}
+
+
+#if defined(NANOHA)
+/// EvalCache::set_size() resizes the evaluation cache to the largest power of
+/// two number of entries that fits in mbSize megabytes. A size of 0 disables
+/// the cache. The entries are cleared only when the size changes, since a
+/// static evaluation gets stale only when the evaluation function changes
+/// (see clear()).
+
+void EvalCache::set_size(size_t mbSize) {
+
+	size_t newSize = 0;
+	if (mbSize)
+		for (newSize = 1; newSize * 2 * sizeof(uint64_t) <= (mbSize << 20); newSize *= 2) {}
+
+	if (newSize == (entries ? mask + 1 : 0))
+		return;
+
+	free(entries);
+	entries = NULL;
+	mask = 0;
+
+	if (!newSize)
+		return;
+
+	entries = static_cast<uint64_t*>(calloc(newSize, sizeof(uint64_t)));
+	if (!entries)
+	{
+		std::cerr << "Failed to allocate " << mbSize
+		          << "MB for evaluation cache." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	mask = newSize - 1;
+}
+
+
+/// EvalCache::clear() empties the cache, when another evaluation function has
+/// been selected.
+
+void EvalCache::clear() {
+
+	if (entries)
+		memset(entries, 0, (mask + 1) * sizeof(uint64_t));
+}
+#endif
@@ -21,7 +21,9 @@
 #if !defined(TT_H_INCLUDED)
 #define TT_H_INCLUDED
 
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 #include "move.h"
 #include "types.h"
@@ -48,43 +50,104 @@
 /// Ȃ̂͂ł̕Kvbit
 /// The TTEntry is the class of transposition table entries
 ///
-/// A TTEntry needs 192 bits to be stored
+/// A TTEntry needs 128 bits to be stored, so that a cluster of four entries
+/// fits exactly in one 64 bytes cache line. It is made of two 64 bits words.
 ///
-/// bit   0- 15: depth : 16bits
-/// bit  16- 63: key : 48bits
-/// bit  64- 95: move : 32bits
-/// bit  96-125: hand : 30bits
-/// bit 126-127: value type : 2bits
-/// bit 128-143: generation : 16bits
-/// bit 144-159: value : 16bits
-/// bit 160-175: static value : 16bits
-/// bit 176-191: margin of static value : 16bits
+/// key word
+/// bit   0- 31: key (high 32 bits of the position key) : 32bits
+/// bit  32- 61: hand : 30bits
+/// bit  62- 63: value type : 2bits
+///
+/// data word
+/// bit   0- 15: move (packed, see pack_move()) : 16bits
+/// bit  16- 31: value : 16bits
+/// bit  32- 47: static value : 16bits
+/// bit  48- 55: depth (biased by DEPTH_TT_OFFSET) : 8bits
+/// bit  56- 63: generation : 8bits
+///
+/// The low bits of the position key select the cluster, so only the high 32
+/// bits need to be kept in the entry. The margin of the static value is not
+/// stored: evaluate() always returns a zero margin in shogi.
+///
+/// As for Mate3_Hash in mate.cpp, the key word is stored XORed with the data
+/// word. Each word is written with a single store, so when two threads write
+/// the same slot at once, or a thread reads it while another one writes it,
+/// the words no longer match and the key check fails. The table needs no lock.
+/// TranspositionTable::probe() returns a copy of the entry, so that the fields
+/// read by the search all come from the same checked pair of words.
+///
+/// A move is packed in 16 bits as
+///
+/// bit  0- 6: destination square (0-80)
+/// bit  7-13: origin square (0-80), or 81 + piece type - 1 for a drop
+/// bit 14   : promotion flag
+///
+/// and is rebuilt with the moving and captured pieces taken from the board.
+
+class Position;
 
 class TTEntry {
 
 public:
 #if defined(NANOHA)
-	void save(uint64_t k, uint32_t h, Value v, ValueType t, Depth d, Move m, int g, Value statV, Value statM) {
-
-		key_depth    = (k & ~UINT64_C(0xFFFF)) | (d & 0xFFFF);
-		move32       = m;
-		hand30       = (h & 0x3FFFFFFF) | (t << 30);
-		generation16 = uint16_t(g);
-		value16      = int16_t(v);
-		staticValue  = int16_t(statV);
-		staticMargin = int16_t(statM);
+	void save(uint64_t k, uint32_t h, Value v, ValueType t, Depth d, uint16_t m16, int g, Value statV) {
+
+		const uint64_t data = uint64_t(m16)
+		                    | (uint64_t(uint16_t(v)) << 16)
+		                    | (uint64_t(uint16_t(statV)) << 32)
+		                    | (uint64_t(pack_depth(d)) << 48)
+		                    | (uint64_t(uint8_t(g)) << 56);
+		const uint64_t key = (k >> 32)
+		                   | (uint64_t(h & 0x3FFFFFFF) << 32)
+		                   | (uint64_t(t) << 62);
+		data64 = data;
+		key64 = key ^ data;
+	}
+	void set_generation(int g) {
+
+		const uint64_t key = key64 ^ data64;
+		const uint64_t data = (data64 & ~(UINT64_C(0xFF) << 56)) | (uint64_t(uint8_t(g)) << 56);
+		data64 = data;
+		key64 = key ^ data;
+	}
+	void set_type(ValueType t) { key64 ^= (key64 ^ data64 ^ (uint64_t(t) << 62)) & (UINT64_C(3) << 62); }
+
+	uint32_t key() const              { return uint32_t(key64 ^ data64); }
+	uint32_t hand() const             { return uint32_t((key64 ^ data64) >> 32) & 0x3FFFFFFF; }
+	Depth depth() const               { return depth8() ? Depth(depth8() + DEPTH_TT_OFFSET) : DEPTH_NONE; }
+	Move move(const Position& pos) const;
+	uint16_t packed_move() const      { return uint16_t(data64); }
+	Value value() const               { return Value(int16_t(data64 >> 16)); }
+	ValueType type() const            { return ValueType((key64 ^ data64) >> 62); }
+	int generation() const            { return int(uint8_t(data64 >> 56)); }
+	Value static_value() const        { return Value(int16_t(data64 >> 32)); }
+	Value static_value_margin() const { return VALUE_ZERO; }
+
+	static uint16_t pack_move(Move m) {
+
+		if (m == MOVE_NONE || m == MOVE_NULL)
+			return 0;
+
+		int from = move_is_drop(m) ? 81 + move_ptype(m) - 1 : conv_z2sq(move_from(m));
+		return uint16_t(conv_z2sq(move_to(m)) | (from << 7) | (is_promotion(m) ? (1 << 14) : 0));
 	}
-	void set_generation(int g) { generation16 = uint16_t(g); }
-
-	uint64_t key() const              { return (key_depth & ~UINT64_C(0xFFFF)); }
-	uint32_t hand() const             { return (hand30 & 0x3FFFFFFF); }
-	Depth depth() const               { return Depth((int16_t)(key_depth & 0xFFFF)); }
-	Move move() const                 { return Move(move32); }
-	Value value() const               { return Value(value16); }
-	ValueType type() const            { return ValueType((hand30 >> 30) & 0x0003); }
-	int generation() const            { return int(generation16); }
-	Value static_value() const        { return Value(staticValue); }
-	Value static_value_margin() const { return Value(staticMargin); }
+
+private:
+	// Depths stored in the table are DEPTH_NONE, the two qsearch depths and
+	// the main search depths, so a small bias is enough to fit them in 8 bits.
+	static const int DEPTH_TT_OFFSET = int(DEPTH_QS_NO_CHECKS) - 2 * int(ONE_PLY);
+
+	static uint8_t pack_depth(Depth d) {
+
+		if (d == DEPTH_NONE)
+			return 0;
+
+		int v = d - DEPTH_TT_OFFSET;
+		return uint8_t(v < 1 ? 1 : v > 255 ? 255 : v);
+	}
+	int depth8() const { return int(uint8_t(data64 >> 48)); }
+
+public:
 #else
 	void save(uint32_t k, Value v, ValueType t, Depth d, Move m, int g, Value statV, Value statM) {
 
@@ -102,6 +165,7 @@ public:
 	uint32_t key() const              { return key32; }
 	Depth depth() const               { return (Depth)depth16; }
 	Move move() const                 { return (Move)move16; }
+	Move move(const Position&) const  { return (Move)move16; }
 	Value value() const               { return (Value)value16; }
 	ValueType type() const            { return (ValueType)valueType; }
 	int generation() const            { return (int)generation8; }
@@ -111,11 +175,7 @@ public:
 
 private:
 #if defined(NANOHA)
-	uint64_t key_depth;
-	uint32_t hand30;
-	uint32_t move32;
-	uint16_t generation16;
-	int16_t value16, staticValue, staticMargin;
+	uint64_t key64, data64;
 #else
 	uint32_t key32;
 	uint16_t move16;
@@ -134,13 +194,41 @@ const int ClusterSize = 4;
 /// must not be bigger than a cache line size. In case it is less, it should
 /// be padded to guarantee always aligned accesses.
 
+#if defined(NANOHA)
+struct CACHE_LINE_ALIGNMENT TTCluster {
+	TTEntry data[ClusterSize];
+};
+#else
 struct TTCluster {
 	TTEntry data[ClusterSize];
 };
+#endif
+
+
+/// ReplacePolicy selects how TranspositionTable::store() picks the entry to
+/// overwrite when a bucket is full (see the Replace<> specialisations in tt.cpp).
+///
+/// REPLACE_DEFAULT   : the Stockfish rule, old generation first, then shallow depth
+/// REPLACE_TWO_TIER  : depth-preferred slots plus one always-replace slot
+/// REPLACE_AGE_DEPTH : smallest depth, each generation of age costing 8 plies
+
+enum ReplacePolicy {
+	REPLACE_DEFAULT,
+	REPLACE_TWO_TIER,
+	REPLACE_AGE_DEPTH,
+	REPLACE_POLICY_NB
+};
 
 
 /// The transposition table class. This is basically just a huge array containing
-/// TTCluster objects, and a few methods for writing and reading entries.
+/// TTCluster objects, and a few methods for writing and reading entries. The
+/// array is allocated with huge pages when possible (see alloc_table()), and
+/// can be shared between engine processes (see attach_shared()).
+///
+/// A position is looked up in a bucket of bucketSize consecutive entries. The
+/// default bucket is one cluster; wider buckets span 2 or 4 cache lines and
+/// narrower ones split a cluster. store() is instantiated once per policy and
+/// called through storeFn, so the replacement rule costs no test at run time.
 
 class TranspositionTable {
 
@@ -152,47 +240,123 @@ public:
 	~TranspositionTable();
 	void set_size(size_t mbSize);
 	void clear();
+	void set_replacement(int policy, int width);
+	int replace_policy() const { return int(policy); }
+	int bucket_size() const { return 1 << bucketShift; }
 #if defined(NANOHA)
-	void store(const Key posKey, uint32_t h, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
-	TTEntry* probe(const Key posKey, uint32_t h) const;
+	void store(const Key posKey, uint32_t h, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD) {
+		(this->*storeFn)(posKey, h, v, type, d, m, statV, kingD);
+	}
+	const TTEntry* probe(const Key posKey, uint32_t h, TTEntry& copy) const;
+	const TTEntry* probe_dominance(const Key posKey, uint32_t h, TTEntry& copy) const;
+	void refresh(const Key posKey, uint32_t h) const;
 #else
-	void store(const Key posKey, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
+	void store(const Key posKey, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD) {
+		(this->*storeFn)(posKey, v, type, d, m, statV, kingD);
+	}
 	TTEntry* probe(const Key posKey) const;
+	void refresh(const TTEntry* tte) const;
 #endif
 	void new_search();
 	TTEntry* first_entry(const Key posKey) const;
-	void refresh(const TTEntry* tte) const;
+	size_t size_mb() const { return (size * sizeof(TTCluster)) >> 20; }
+	int hashfull() const;
+	void print_stats(std::ostream& os) const;
+	bool save(const std::string& fname) const;
+	bool load(const std::string& fname);
 
 private:
-	size_t size;
-	TTCluster* entries;
 #if defined(NANOHA)
-	uint16_t generation; // Size must be not bigger then TTEntry::generation8
+	typedef void (TranspositionTable::*StoreFn)(const Key, uint32_t, Value, ValueType, Depth, Move, Value, Value);
+	template<ReplacePolicy P>
+	void do_store(const Key posKey, uint32_t h, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
 #else
-	uint8_t generation; // Size must be not bigger then TTEntry::generation8
+	typedef void (TranspositionTable::*StoreFn)(const Key, Value, ValueType, Depth, Move, Value, Value);
+	template<ReplacePolicy P>
+	void do_store(const Key posKey, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
 #endif
+	void set_buckets() { buckets = Min((uint64_t(size) * ClusterSize) >> bucketShift, UINT64_C(1) << 32); }
+
+	size_t size;
+	uint64_t buckets;
+	int bucketShift;
+	ReplacePolicy policy;
+	StoreFn storeFn;
+	TTCluster* entries;
+	void* mem;
+	size_t memSize;
+	bool memMapped;
+	bool memShared;
+	uint8_t generation; // Size must be not bigger then TTEntry::generation8
 };
 
 extern TranspositionTable TT;
 
 
+#if defined(CHK_PERFORM)
+#if defined(_MSC_VER)
+#define TT_THREAD_LOCAL __declspec(thread)
+#else
+#define TT_THREAD_LOCAL __thread
+#endif
+
+/// TTPerform holds the probe and store counters of the transposition table.
+/// Each search thread has its own cache line of counters, selected by the
+/// thread local index set when the thread starts, so counting costs no more
+/// than an increment. They are printed by TranspositionTable::print_stats().
+namespace TTPerform {
+
+struct CACHE_LINE_ALIGNMENT Counters {
+	uint64_t probes, hits, dominanceHits;
+	uint64_t empty, sameKey, replaceOld, replaceCurrent;
+};
+
+extern TT_THREAD_LOCAL int threadIdx;
+extern Counters counters[];
+void reset();
+}
+
+#define TT_COUNTERS (TTPerform::counters[TTPerform::threadIdx])
+#endif
+
+
 /// TranspositionTable::first_entry() returns a pointer to the first entry of
-/// a cluster given a position. The lowest order bits of the key are used to
-/// get the index of the cluster.
+/// a bucket given a position. The low 32 bits of the key are mapped onto
+/// [0, buckets) with a multiply-shift, so the table does not need a power of
+/// two number of clusters. The side to move lives in bit 0 of the key and
+/// would hardly change the product, so it is rotated to the top bit first:
+/// each side to move gets its own half of the table.
 
 inline TTEntry* TranspositionTable::first_entry(const Key posKey) const {
 
-	return entries[((uint32_t)posKey) & (size - 1)].data;
+	const uint32_t k = (uint32_t(posKey) >> 1) | (uint32_t(posKey) << 31);
+	return reinterpret_cast<TTEntry*>(entries) + (((uint64_t(k) * buckets) >> 32) << bucketShift);
 }
 
 
 /// TranspositionTable::refresh() updates the 'generation' value of the TTEntry
-/// to avoid aging. Normally called after a TT hit.
+/// to avoid aging. Normally called after a TT hit. In shogi the search only
+/// holds a copy of the entry, so the slot is looked up again from the key.
 
+#if defined(NANOHA)
+inline void TranspositionTable::refresh(const Key posKey, uint32_t h) const {
+
+	const uint32_t posKey32 = posKey >> 32;
+	TTEntry* tte = first_entry(posKey);
+
+	for (int i = 0; i < bucket_size(); i++, tte++)
+		if (tte->key() == posKey32 && tte->hand() == h)
+		{
+			tte->set_generation(generation);
+			return;
+		}
+}
+#else
 inline void TranspositionTable::refresh(const TTEntry* tte) const {
 
 	const_cast<TTEntry*>(tte)->set_generation(generation);
 }
+#endif
 
 
 /// A simple fixed size hash table used to store pawns and material
@@ -229,4 +393,54 @@ protected:
 };
 #endif
 
+
+#if defined(NANOHA)
+/// EvalCache is a small direct mapped table of static evaluations, one per
+/// search thread, so that a position reached again through a transposition
+/// is not evaluated twice even when its TT entry was overwritten. It is looked
+/// up with the position key mixed with the hand of the first player (the board
+/// and one hand fix the other hand). An entry is a single 64 bit word holding
+/// the upper 32 bits of that key and the value, and an empty entry is zero.
+
+class EvalCache {
+
+	EvalCache(const EvalCache&);
+	EvalCache& operator=(const EvalCache&);
+
+public:
+	EvalCache() : entries(NULL), mask(0), probes(0), hits(0) {}
+	~EvalCache() { free(entries); }
+	void set_size(size_t mbSize);
+	void clear();
+	bool enabled() const { return entries != NULL; }
+	bool probe(const Key k, Value& v);
+	void store(const Key k, Value v) { entries[index(k)] = (k & ~UINT64_C(0xFFFFFFFF)) | uint32_t(v); }
+	void reset_stats() { probes = hits = 0; }
+	uint64_t probe_count() const { return probes; }
+	uint64_t hit_count() const { return hits; }
+
+	static Key key(const Key posKey, uint32_t handB) { return posKey ^ (Key(handB) * UINT64_C(0x9E3779B97F4A7C15)); }
+
+private:
+	size_t index(const Key k) const { return size_t(k >> 1) & mask; }	// bit 0 is the side to move
+
+	uint64_t* entries;
+	size_t mask;
+	uint64_t probes, hits;
+};
+
+inline bool EvalCache::probe(const Key k, Value& v) {
+
+	const uint64_t e = entries[index(k)];
+
+	probes++;
+	if ((e ^ k) >> 32)
+		return false;
+
+	hits++;
+	v = Value(int32_t(uint32_t(e)));
+	return true;
+}
+#endif
+
 #endif // !defined(TT_H_INCLUDED)
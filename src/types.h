@@ -166,6 +166,51 @@ const bool CpuHasPOPCNT = cpu_has_popcnt();
 const bool CpuHasPOPCNT = false;
 #endif
 
+/// cpu_has_avx2() detects support for AVX2 instructions at runtime. The
+/// OS must also save the YMM registers on context switches (XCR0 bits 1-2).
+inline bool cpu_has_avx2()
+{
+	int CPUInfo[4] = {-1};
+	__cpuid(CPUInfo, 0x00000000);
+	if (CPUInfo[0] < 7)
+		return false;
+
+	__cpuid(CPUInfo, 0x00000001);
+	if (((CPUInfo[2] >> 27) & 1) == 0 || ((CPUInfo[2] >> 28) & 1) == 0)	// OSXSAVE, AVX
+		return false;
+
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	unsigned int lo, hi;
+	__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)hi << 32) | lo;
+#else
+	unsigned long long xcr0 = 0;
+#endif
+	if ((xcr0 & 6) != 6)
+		return false;
+
+	__cpuid(CPUInfo, 0x00000007);
+	return (CPUInfo[1] >> 5) & 1;
+}
+
+/// CpuHasAVX2 is set at startup to true if the CPU and the OS support AVX2.
+/// Unless USE_SIMD is not defined.
+#if defined(USE_SIMD)
+const bool CpuHasAVX2 = cpu_has_avx2();
+#else
+const bool CpuHasAVX2 = false;
+#endif
+
+// TARGET_AVX2 lets a single function use AVX2 instructions while the rest
+// of the program is built for the baseline instruction set.
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
 /// CpuIs64Bit is a global constant initialized at compile time that
 /// is set to true if CPU on which application runs is a 64 bits.
 #if defined(IS_64BIT)
@@ -847,8 +892,8 @@ inline void operator/=(Score &d, int i) { d = Score(int(d) / i); }
 #if defined(NANOHA)
 const Value PawnValueMidgame = Value(87 + 87);
 
-extern const Value PieceValueMidgame[32];
-extern const Value PieceValueEndgame[32];
+extern Value PieceValueMidgame[32];
+extern Value PieceValueEndgame[32];
 
 #else
 const Value PawnValueMidgame = Value(0x0C6);
@@ -1064,9 +1109,9 @@ namespace NanohaTbl
 {
 extern const short z2sq[];
 extern const int Direction[];
-extern const int KomaValue[32];    // ��̉��l
-extern const int KomaValueEx[32];  // ���ꂽ�Ƃ�(�ߊl���ꂽ�Ƃ�)�̉��l
-extern const int KomaValuePro[32]; // ���鉿�l
+extern int KomaValue[32];    // ��̉��l
+extern int KomaValueEx[32];  // ���ꂽ�Ƃ�(�ߊl���ꂽ�Ƃ�)�̉��l
+extern int KomaValuePro[32]; // ���鉿�l
 extern const int Piece2Index[32];  // ��̎�ނɕϊ�����({�ƁA�ǁA�\�A�S}�����Ɠ��ꎋ)
 }
 
@@ -29,6 +29,7 @@
 #include "move.h"
 #include "position.h"
 #include "search.h"
+#include "tt.h"
 #include "ucioption.h"
 
 using namespace std;
@@ -52,6 +53,9 @@ namespace {
 	void set_position(Position& pos, istringstream& up);
 	bool go(Position& pos, istringstream& up);
 	void perft(Position& pos, istringstream& up);
+#if defined(NANOHA)
+	void hash_file(const string& cmd, istringstream& up);
+#endif
 }
 
 
@@ -76,6 +80,14 @@ void uci_loop() {
 
 		is >> skipws >> token;
 
+#if defined(NANOHA)
+		// ]xNg̓ǂݍ݂Ȃǂ͋NɕʃXbhŎn߂Ă.
+		// gR}hƁAu\̃IvVςR}h̑OŊ҂
+		if (   token == "go" || token == "isready" || token == "setoption"
+		    || token == "savehash" || token == "loadhash" || token == "ttstats")
+			wait_for_initialization();
+#endif
+
 		if (token == "quit")
 			quit = true;
 
@@ -92,7 +104,12 @@ void uci_loop() {
 
 #if defined(NANOHA)
 		else if (token == "isready") {
-			// TODO:{͎Ԃ鏉ōs.
+			// Ԃ鏉͋NɎn߂ĂāA܂łɊĂ.
+			// u\̑傫ςĂ΁Aŏ go ł͂ȂŊmۂ
+			TT.set_size(Options["Hash"].value<int>());
+			// ]֐ςĂΕ]xNgǂݍ݁Aǖʂ̕]蒼
+			if (select_evaluator(Options["EvalType"].value<string>()))
+				pos.reset_evaluation();
 			cout << "readyok" << endl;
 		}
 #else
@@ -154,10 +171,27 @@ void uci_loop() {
 			is >> token;
 			cout << token << endl;
 		}
+		else if (token == "savehash" || token == "loadhash")
+			hash_file(token, is);
+		else if (token == "ttstats") {
+			// "ttstats reset" clears the counters without printing them.
+			if (is >> token && token == "reset") {
+#if defined(CHK_PERFORM)
+				TTPerform::reset();
+#endif
+			}
+			else
+				TT.print_stats(cout);
+		}
 #endif
 		else
 			cout << "Unknown command: " << cmd << endl;
 	}
+
+#if defined(NANOHA)
+	//  quit ĂAȊOɕЕtĂ
+	wait_for_initialization();
+#endif
 }
 
 
@@ -315,4 +349,45 @@ namespace {
 		          << "\nTime (ms) " << time
 		          << "\nNodes/second " << int(n / (time / 1000.0)) << std::endl;
 	}
+
+#if defined(NANOHA)
+	// hash_file() is called when engine receives the "savehash <file>" or
+	// "loadhash <file>" command. It writes the transposition table to a file
+	// or replaces it with the content of a file written before.
+
+	void hash_file(const string& cmd, istringstream& is) {
+
+		string fname;
+
+		if (!(is >> fname))
+		{
+			cout << "info string usage: " << cmd << " <file>" << endl;
+			return;
+		}
+
+		if (cmd == "savehash")
+		{
+			if (TT.save(fname))
+				cout << "info string hash saved to " << fname << endl;
+			else
+				cout << "info string failed to save hash to " << fname << endl;
+			return;
+		}
+
+		if (!TT.load(fname))
+		{
+			cout << "info string failed to load hash from " << fname << endl;
+			return;
+		}
+
+		// Keep the Hash and TTBucketSize options in line with the loaded table,
+		// otherwise the next search would resize, and so clear, the table.
+		std::ostringstream mb, width;
+		mb << TT.size_mb();
+		width << TT.bucket_size();
+		Options["Hash"].set_value(mb.str());
+		Options["TTBucketSize"].set_value(width.str());
+		cout << "info string hash loaded from " << fname << " (" << TT.size_mb() << "MB)" << endl;
+	}
+#endif
 }
@@ -21,8 +21,10 @@
 #include <cctype>
 #include <iostream>
 #include <sstream>
+#include "evaluate.h"
 #include "misc.h"
 #include "thread.h"
+#include "tt.h"
 #include "ucioption.h"
 
 using std::string;
@@ -82,7 +84,15 @@ OptionsMap::OptionsMap() {
 	o["Ponder"] = UCIOption(true);
 #endif
 	o["Threads"] = UCIOption(1, 1, MAX_THREADS);
-	o["Hash"] = UCIOption(256, 4, 1024);
+	o["Hash"] = UCIOption(256, 4, CpuIs64Bit ? 262144 : 2048);
+	o["LargePages"] = UCIOption(true);
+	o["NumaInterleave"] = UCIOption(false);
+	o["SharedHash"] = UCIOption(false);
+	o["SharedHashName"] = UCIOption("nanohamini_tt");
+	o["TTReplacePolicy"] = UCIOption(0, 0, REPLACE_POLICY_NB - 1);
+	o["TTBucketSize"] = UCIOption(ClusterSize, 2, 16);
+	o["EvalCache"] = UCIOption(1, 0, 64);
+	o["EvalType"] = UCIOption(EVAL_DEFAULT_NAME);	// nano, mini, apery or nnue. isready Ő؂ւ
 
 	o["Use Search Log"] = UCIOption(false);
 	o["Search Log Filename"] = UCIOption("SearchLog.txt");